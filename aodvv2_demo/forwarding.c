@@ -0,0 +1,552 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     aodvv2
+ * @{
+ *
+ * @file        forwarding.c
+ * @brief       routing provider that wraps aodv_get_next_hop()
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mutex.h"
+#include "vtimer.h"
+
+#include "aodv.h"
+#include "constants.h"
+#include "routing.h"
+#include "seqnum.h"
+#include "utils.h"
+
+#include "forwarding.h"
+#include "ratelimit.h"
+#include "routefeed.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+/* state of a slot in _repairs */
+enum forwarding_repair_state {
+    REPAIR_FREE,
+    REPAIR_RUNNING,         /* repair RREQ sent, waiting for a new route */
+    REPAIR_RERR_PENDING,    /* repair timed out, RERR not sent yet */
+};
+
+/* a destination whose route broke and is being repaired locally */
+struct forwarding_repair {
+    uint8_t state;
+    struct netaddr addr;
+    uint64_t deadline;      /* microseconds */
+};
+
+/* a neighbor that offered a route to the destination and its own distance to it */
+struct forwarding_alternate {
+    struct netaddr addr;
+    uint8_t distance;
+};
+
+/* the primary next hop of a route as it was last seen and the neighbors that
+ * can take over if the link to it breaks */
+struct forwarding_backup {
+    bool active;
+    bool failed_over;
+    struct netaddr addr;
+    struct netaddr nextHopAddr;
+    uint16_t seqnum;
+    uint8_t metric;
+    uint8_t num_alternates;
+    struct forwarding_alternate alternates[FORWARDING_MAX_ALTERNATES];
+    ipv6_addr_t next_hop;   /* alternate handed out by forwarding_get_next_hop() */
+};
+
+/* a route that has been refreshed. As long as its expirationTime doesn't
+ * change, the refresh is still pending and mustn't be started again. */
+struct forwarding_refresh {
+    struct netaddr addr;
+    timex_t expirationTime;
+};
+
+static struct forwarding_refresh _refreshes[FORWARDING_MAX_REFRESHES];
+static unsigned _next_refresh;
+static struct netaddr _local_dests[FORWARDING_MAX_LOCAL_DESTS];
+static unsigned _next_local_dest;
+static struct forwarding_repair _repairs[FORWARDING_MAX_REPAIRS];
+static bool _local_repair = FORWARDING_LOCAL_REPAIR;
+static struct forwarding_backup _backups[FORWARDING_MAX_BACKUP_ROUTES];
+static unsigned _next_backup;
+static bool _backup_routes = FORWARDING_BACKUP_ROUTES;
+static mutex_t _mutex;
+
+static uint32_t _num_refreshes, _num_refreshes_throttled;
+static uint32_t _num_repairs, _num_repairs_succeeded, _num_repairs_failed, _num_repair_drops;
+static uint32_t _num_rerrs_throttled;
+static uint32_t _num_alternates_learned, _num_failovers;
+
+#if ENABLE_DEBUG
+static struct netaddr_str nbuf;
+#endif
+
+static uint64_t _now_us(void);
+static bool _is_reachable_neighbor(struct netaddr *addr);
+static bool _handle_broken_link(ipv6_addr_t *dest, struct aodvv2_routing_entry_t *entry);
+static struct forwarding_repair *_find_repair(struct netaddr *addr);
+static void _finish_repair(struct netaddr *addr);
+static struct forwarding_backup *_find_backup(struct netaddr *addr);
+static void _track_route(struct aodvv2_routing_entry_t *entry);
+static bool _is_loop_free(uint8_t neighbor_distance, uint8_t distance);
+static bool _get_alternate(ipv6_addr_t *dest, struct aodvv2_routing_entry_t *entry,
+                           ipv6_addr_t **next_hop);
+static void _refresh_if_needed(ipv6_addr_t *dest, struct aodvv2_routing_entry_t *entry);
+static bool _refresh_pending(struct aodvv2_routing_entry_t *entry);
+static void _remember_refresh(struct aodvv2_routing_entry_t *entry);
+static bool _is_local_destination(struct netaddr *addr);
+static void _send_rreq(ipv6_addr_t *dest, struct aodvv2_routing_entry_t *entry, uint8_t hoplimit,
+                       const char *reason);
+
+void forwarding_init(void)
+{
+    mutex_init(&_mutex);
+    memset(_refreshes, 0, sizeof(_refreshes));
+    memset(_local_dests, 0, sizeof(_local_dests));
+    memset(_repairs, 0, sizeof(_repairs));
+    memset(_backups, 0, sizeof(_backups));
+    ipv6_iface_set_routing_provider(forwarding_get_next_hop);
+}
+
+ipv6_addr_t *forwarding_get_next_hop(ipv6_addr_t *dest)
+{
+    struct netaddr na_dest;
+
+    ipv6_addr_t_to_netaddr(dest, &na_dest);
+    struct aodvv2_routing_entry_t *entry = routingtable_get_entry(&na_dest, AODVV2_DEFAULT_METRIC_TYPE);
+
+    if (entry && (entry->state != ROUTE_STATE_BROKEN)) {
+        if (!_is_reachable_neighbor(&entry->nextHopAddr)) {
+            ipv6_addr_t *alternate;
+            if (_get_alternate(dest, entry, &alternate)) {
+                /* aodv_get_next_hop() isn't asked, so do what it and the
+                 * code below would have done for a route in use */
+                vtimer_now(&entry->lastUsed);
+                _refresh_if_needed(dest, entry);
+                routefeed_update(&na_dest);
+                return alternate;
+            }
+
+            /* aodv_get_next_hop() would mark the route as broken and send a
+             * RERR right away */
+            if (!_handle_broken_link(dest, entry)) {
+                return NULL;
+            }
+        }
+        else {
+            _finish_repair(&entry->addr);
+            _track_route(entry);
+        }
+    }
+
+    ipv6_addr_t *next_hop = aodv_get_next_hop(dest);
+
+    /* dest may be a neighbor, in which case there is no route to refresh */
+    if (next_hop && entry) {
+        _refresh_if_needed(dest, entry);
+    }
+
+    /* aodv_get_next_hop() may have marked the route as broken */
+    routefeed_update(&na_dest);
+    return next_hop;
+}
+
+void forwarding_add_local_destination(ipv6_addr_t *dest)
+{
+    struct netaddr na_dest;
+
+    ipv6_addr_t_to_netaddr(dest, &na_dest);
+    mutex_lock(&_mutex);
+    if (!_is_local_destination(&na_dest)) {
+        _local_dests[_next_local_dest] = na_dest;
+        _next_local_dest = (_next_local_dest + 1) % FORWARDING_MAX_LOCAL_DESTS;
+    }
+    mutex_unlock(&_mutex);
+}
+
+void forwarding_set_local_repair(bool enable)
+{
+    mutex_lock(&_mutex);
+    _local_repair = enable;
+    memset(_repairs, 0, sizeof(_repairs));
+    mutex_unlock(&_mutex);
+}
+
+void forwarding_set_backup_routes(bool enable)
+{
+    mutex_lock(&_mutex);
+    _backup_routes = enable;
+    memset(_backups, 0, sizeof(_backups));
+    mutex_unlock(&_mutex);
+}
+
+void forwarding_print_stats(void)
+{
+    printf("route refreshes started: %" PRIu32 ", throttled: %" PRIu32 "\n",
+           _num_refreshes, _num_refreshes_throttled);
+    printf("local repair: %s, started: %" PRIu32 ", succeeded: %" PRIu32 ", failed: %" PRIu32
+           ", packets dropped while repairing: %" PRIu32 "\n", _local_repair ? "on" : "off",
+           _num_repairs, _num_repairs_succeeded, _num_repairs_failed, _num_repair_drops);
+    printf("RERRs throttled: %" PRIu32 "\n", _num_rerrs_throttled);
+    printf("backup next hops: %s, learned: %" PRIu32 ", failovers: %" PRIu32 "\n",
+           _backup_routes ? "on" : "off", _num_alternates_learned, _num_failovers);
+}
+
+static uint64_t _now_us(void)
+{
+    timex_t now;
+    vtimer_now(&now);
+    return timex_uint64(now);
+}
+
+static bool _is_reachable_neighbor(struct netaddr *addr)
+{
+    ipv6_addr_t ipv6_addr;
+
+    netaddr_to_ipv6_addr_t(addr, &ipv6_addr);
+    ndp_neighbor_cache_t *nc_entry = ndp_neighbor_cache_search(&ipv6_addr);
+    return (nc_entry && (nc_entry->state == NDP_NCE_STATUS_REACHABLE));
+}
+
+/*
+ * The link to the next hop of entry is gone. With local repair enabled, try
+ * to find a new route with a RREQ that only travels a little further than the
+ * old route was long and drop packets to dest until either a new route has
+ * been found or FORWARDING_REPAIR_WAIT_TIME has passed.
+ *
+ * A repair that timed out stays in its slot until the RERR could be sent, so
+ * that a destination that can't be repaired doesn't start another repair with
+ * every packet while the RERR is being throttled.
+ *
+ * Returns true if the packet should be handed to aodv_get_next_hop() so that
+ * it sends the RERR, false if it should be dropped.
+ */
+static bool _handle_broken_link(ipv6_addr_t *dest, struct aodvv2_routing_entry_t *entry)
+{
+    uint64_t now = _now_us();
+    bool send_rerr = true;
+    bool start_repair = false;
+
+    mutex_lock(&_mutex);
+    if (_local_repair) {
+        struct forwarding_repair *repair = _find_repair(&entry->addr);
+
+        if (!repair) {
+            struct forwarding_repair *free_slot = _find_repair(NULL);
+            if (free_slot && ratelimit_try_acquire(RATELIMIT_RREQ_ORIG)) {
+                repair = free_slot;
+                repair->state = REPAIR_RUNNING;
+                repair->addr = entry->addr;
+                repair->deadline = now + FORWARDING_REPAIR_WAIT_TIME;
+                start_repair = true;
+                _num_repairs++;
+            }
+        }
+
+        if (repair && (repair->state == REPAIR_RUNNING) && (now < repair->deadline)) {
+            send_rerr = false;
+            _num_repair_drops++;
+        }
+        else if (repair && (repair->state == REPAIR_RUNNING)) {
+            repair->state = REPAIR_RERR_PENDING;
+            _num_repairs_failed++;
+        }
+    }
+
+    /* a RERR that doesn't get a token is sent for one of the next packets */
+    if (send_rerr && !ratelimit_try_acquire(RATELIMIT_RERR)) {
+        send_rerr = false;
+        _num_rerrs_throttled++;
+    }
+    else if (send_rerr && _local_repair) {
+        /* the RERR goes out now, the route will be marked as broken */
+        struct forwarding_repair *repair = _find_repair(&entry->addr);
+        if (repair) {
+            repair->state = REPAIR_FREE;
+        }
+    }
+    mutex_unlock(&_mutex);
+
+    if (start_repair) {
+        uint16_t hoplimit = entry->metric + FORWARDING_REPAIR_EXTRA_HOPS;
+        _send_rreq(dest, entry, (hoplimit < AODVV2_MAX_HOPCOUNT) ? hoplimit : AODVV2_MAX_HOPCOUNT,
+                   "repair");
+    }
+    return send_rerr;
+}
+
+/* find the running or failed repair for addr, or a free slot if addr is NULL */
+static struct forwarding_repair *_find_repair(struct netaddr *addr)
+{
+    for (unsigned i = 0; i < FORWARDING_MAX_REPAIRS; i++) {
+        if (!addr && (_repairs[i].state == REPAIR_FREE)) {
+            return &_repairs[i];
+        }
+        if (addr && (_repairs[i].state != REPAIR_FREE)
+            && (netaddr_cmp(&_repairs[i].addr, addr) == 0)) {
+            return &_repairs[i];
+        }
+    }
+    return NULL;
+}
+
+/* the route to addr is usable again; if it was being repaired, that worked.
+ * A pending RERR is obsolete now. */
+static void _finish_repair(struct netaddr *addr)
+{
+    mutex_lock(&_mutex);
+    struct forwarding_repair *repair = _find_repair(addr);
+    if (repair) {
+        if (repair->state == REPAIR_RUNNING) {
+            _num_repairs_succeeded++;
+        }
+        repair->state = REPAIR_FREE;
+    }
+    mutex_unlock(&_mutex);
+}
+
+static struct forwarding_backup *_find_backup(struct netaddr *addr)
+{
+    for (unsigned i = 0; i < FORWARDING_MAX_BACKUP_ROUTES; i++) {
+        if (_backups[i].active && (netaddr_cmp(&_backups[i].addr, addr) == 0)) {
+            return &_backups[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Remember the next hop of a working route. When the route switches to a new
+ * next hop without a change of SeqNum, the old next hop is (old metric - 1)
+ * hops away from the destination itself. It is kept as an alternate if that
+ * distance passes the loop-free check of RFC 5286 against the metric of the
+ * new route, and dropped again as soon as it doesn't. A new SeqNum
+ * invalidates all alternates, since what they offered may be outdated by now.
+ */
+static void _track_route(struct aodvv2_routing_entry_t *entry)
+{
+    if (!_backup_routes) {
+        return;
+    }
+
+    mutex_lock(&_mutex);
+    struct forwarding_backup *backup = _find_backup(&entry->addr);
+
+    if (!backup) {
+        backup = &_backups[_next_backup];
+        _next_backup = (_next_backup + 1) % FORWARDING_MAX_BACKUP_ROUTES;
+        memset(backup, 0, sizeof(*backup));
+        backup->active = true;
+        backup->addr = entry->addr;
+    }
+    else if (backup->seqnum != entry->seqnum) {
+        backup->num_alternates = 0;
+    }
+    else if ((netaddr_cmp(&backup->nextHopAddr, &entry->nextHopAddr) != 0)
+             && (backup->metric > 0)
+             && (backup->num_alternates < FORWARDING_MAX_ALTERNATES)) {
+        struct forwarding_alternate *alternate = &backup->alternates[backup->num_alternates++];
+        alternate->addr = backup->nextHopAddr;
+        alternate->distance = backup->metric - 1;
+        _num_alternates_learned++;
+    }
+
+    /* the primary next hop can't be its own alternate, and an alternate that
+     * isn't loop-free with the current metric mustn't be used */
+    for (unsigned i = 0; i < backup->num_alternates;) {
+        if ((netaddr_cmp(&backup->alternates[i].addr, &entry->nextHopAddr) == 0)
+            || !_is_loop_free(backup->alternates[i].distance, entry->metric)) {
+            backup->alternates[i] = backup->alternates[--backup->num_alternates];
+        }
+        else {
+            i++;
+        }
+    }
+
+    backup->nextHopAddr = entry->nextHopAddr;
+    backup->seqnum = entry->seqnum;
+    backup->metric = entry->metric;
+    backup->failed_over = false;
+    mutex_unlock(&_mutex);
+}
+
+/*
+ * RFC 5286, inequality 1: a neighbor N can be used as next hop towards D
+ * without the risk of a loop through this node S if
+ * Distance(N, D) < Distance(N, S) + Distance(S, D). With hop count as metric,
+ * Distance(N, S) is 1.
+ */
+static bool _is_loop_free(uint8_t neighbor_distance, uint8_t distance)
+{
+    return neighbor_distance < 1 + distance;
+}
+
+/*
+ * The link to the primary next hop of entry is gone: return the first
+ * alternate that is still a neighbor through next_hop. The address lives in
+ * the backup of the route, so lookups for other destinations don't overwrite
+ * it. The first time a route fails over, a RREQ is sent to get a proper route
+ * in the background. It counts as the refresh of the route.
+ *
+ * Returns true if an alternate was found.
+ */
+static bool _get_alternate(ipv6_addr_t *dest, struct aodvv2_routing_entry_t *entry,
+                           ipv6_addr_t **next_hop)
+{
+    bool found = false;
+    bool rediscover = false;
+
+    if (!_backup_routes) {
+        return false;
+    }
+
+    mutex_lock(&_mutex);
+    struct forwarding_backup *backup = _find_backup(&entry->addr);
+
+    if (backup && (backup->seqnum == entry->seqnum)) {
+        for (unsigned i = 0; i < backup->num_alternates; i++) {
+            struct forwarding_alternate *alternate = &backup->alternates[i];
+            if (_is_loop_free(alternate->distance, entry->metric)
+                && _is_reachable_neighbor(&alternate->addr)) {
+                netaddr_to_ipv6_addr_t(&alternate->addr, &backup->next_hop);
+                *next_hop = &backup->next_hop;
+                found = true;
+                break;
+            }
+        }
+
+        if (found && !backup->failed_over) {
+            backup->failed_over = true;
+            _num_failovers++;
+            rediscover = ratelimit_try_acquire(RATELIMIT_RREQ_ORIG);
+            if (rediscover) {
+                _remember_refresh(entry);
+            }
+        }
+    }
+    mutex_unlock(&_mutex);
+
+    if (rediscover) {
+        _send_rreq(dest, entry, AODVV2_MAX_HOPCOUNT, "failover");
+    }
+    return found;
+}
+
+static void _refresh_if_needed(ipv6_addr_t *dest, struct aodvv2_routing_entry_t *entry)
+{
+    uint64_t expiration = timex_uint64(entry->expirationTime);
+    if (expiration > _now_us() + (uint64_t) FORWARDING_REFRESH_MARGIN * 1000000) {
+        return;
+    }
+
+    /* routers on the way get their route renewed by the RREP to the RREQ of
+     * the node the flow starts at */
+    mutex_lock(&_mutex);
+    if (!_is_local_destination(&entry->addr) || _refresh_pending(entry)) {
+        mutex_unlock(&_mutex);
+        return;
+    }
+
+    /* refreshes are originated RREQs and share their budget, but the
+     * forwarding path can't wait for a token */
+    if (!ratelimit_try_acquire(RATELIMIT_RREQ_ORIG)) {
+        _num_refreshes_throttled++;
+        mutex_unlock(&_mutex);
+        return;
+    }
+
+    _remember_refresh(entry);
+    _num_refreshes++;
+    mutex_unlock(&_mutex);
+
+    DEBUG("[forwarding] route to %s expires soon, refreshing\n",
+          netaddr_to_string(&nbuf, &entry->addr));
+    _send_rreq(dest, entry, AODVV2_MAX_HOPCOUNT, "refresh");
+}
+
+/* check if a refresh for this version of the route has already been sent */
+static bool _refresh_pending(struct aodvv2_routing_entry_t *entry)
+{
+    for (unsigned i = 0; i < FORWARDING_MAX_REFRESHES; i++) {
+        if ((netaddr_cmp(&_refreshes[i].addr, &entry->addr) == 0)
+            && (timex_cmp(_refreshes[i].expirationTime, entry->expirationTime) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* check if this node sends packets to addr itself. Called with _mutex held. */
+static bool _is_local_destination(struct netaddr *addr)
+{
+    for (unsigned i = 0; i < FORWARDING_MAX_LOCAL_DESTS; i++) {
+        if (netaddr_cmp(&_local_dests[i], addr) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* note that a RREQ has been sent for this version of the route. Called with
+ * _mutex held. */
+static void _remember_refresh(struct aodvv2_routing_entry_t *entry)
+{
+    struct forwarding_refresh *refresh = &_refreshes[_next_refresh];
+    _next_refresh = (_next_refresh + 1) % FORWARDING_MAX_REFRESHES;
+    refresh->addr = entry->addr;
+    refresh->expirationTime = entry->expirationTime;
+}
+
+/* originate a RREQ towards the destination of entry. Since TargSeqNum is set,
+ * only routers that know a route at least as fresh as the current one will
+ * answer. Always logged, since aodvv2 only logs the RREQs it originates
+ * itself and vnet_tester/batch_eval.py counts these too. */
+static void _send_rreq(ipv6_addr_t *dest, struct aodvv2_routing_entry_t *entry, uint8_t hoplimit,
+                       const char *reason)
+{
+    ipv6_addr_t local;
+    struct netaddr na_local;
+    struct netaddr_str addr_str;
+    timex_t now;
+
+    ipv6_net_if_get_best_src_addr(&local, dest);
+    ipv6_addr_t_to_netaddr(&local, &na_local);
+    vtimer_now(&now);
+
+    seqnum_inc();
+
+    struct aodvv2_packet_data rreq_data = (struct aodvv2_packet_data) {
+        .hoplimit = hoplimit,
+        .metricType = entry->metricType,
+        .origNode = (struct node_data) {
+            .addr = na_local,
+            .metric = 0,
+            .seqnum = seqnum_get(),
+        },
+        .targNode = (struct node_data) {
+            .addr = entry->addr,
+            .seqnum = entry->seqnum,
+        },
+        .timestamp = now,
+    };
+
+    printf("[forwarding] originating %s RREQ with SeqNum %u towards %s, hop limit %u\n",
+           reason, rreq_data.origNode.seqnum, netaddr_to_string(&addr_str, &entry->addr), hoplimit);
+    aodv_send_rreq(&rreq_data);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     aodvv2
+ * @{
+ *
+ * @file        forwarding.h
+ * @brief       routing provider that wraps aodv_get_next_hop()
+ *
+ * Every packet this node originates or forwards passes through
+ * forwarding_get_next_hop(). Routes that carry traffic and are about to
+ * expire are refreshed with a RREQ before they time out, so that long-lived
+ * flows don't stall while a new route discovery takes place. Only the node a
+ * flow starts at refreshes its route: the RREP to its RREQ renews the route on
+ * every router on the way, so they don't have to flood RREQs of their own.
+ *
+ * If local repair is enabled, a node that notices that the link to the next
+ * hop of a route is gone doesn't send a RERR right away. Instead, it looks for
+ * a new route with a hop-limited RREQ first, and only sends the RERR if that
+ * fails. Packets towards the destination are dropped while the repair is in
+ * progress, since a routing provider can't hold them back. A destination
+ * whose repair failed isn't repaired again until its RERR has been sent.
+ *
+ * If backup routes are enabled, next hops that a route used before it
+ * switched to a better one are kept as alternates as long as they can't cause
+ * a loop. When the link to the primary next hop breaks, traffic is sent to an
+ * alternate immediately while a new route is discovered in the background.
+ * Note that this rarely does anything: an alternate is only learned when the
+ * route changes its next hop without a new SeqNum, and only the old next hop
+ * is learned, with a distance derived from the old metric. Since AODVv2 only
+ * accepts such a route if it is shorter, the old next hop passes the
+ * loop-free check only if the new route is exactly one hop shorter. In
+ * practice, most route changes come with a new SeqNum and clear the
+ * alternates. fwd_stats shows how many alternates were learned.
+ */
+
+#ifndef AODVV2_FORWARDING_H_
+#define AODVV2_FORWARDING_H_
+
+#include <stdbool.h>
+
+#include "ipv6.h"
+
+/* start refreshing a route this many seconds before it expires */
+#define FORWARDING_REFRESH_MARGIN   (5)
+/* number of routes whose refresh is tracked at the same time */
+#define FORWARDING_MAX_REFRESHES    (8)
+/* number of destinations this node sends to that are remembered for refreshing */
+#define FORWARDING_MAX_LOCAL_DESTS  (8)
+
+/* repair broken routes locally before sending a RERR (can be changed at runtime) */
+#define FORWARDING_LOCAL_REPAIR     (false)
+/* hops the repair RREQ may travel in addition to the length of the old route */
+#define FORWARDING_REPAIR_EXTRA_HOPS (2)
+/* time to wait for the repair to succeed before giving up, in microseconds */
+#define FORWARDING_REPAIR_WAIT_TIME (1000000)
+/* number of routes that can be repaired at the same time */
+#define FORWARDING_MAX_REPAIRS      (4)
+
+/* keep alternate next hops for instant failover (can be changed at runtime) */
+#define FORWARDING_BACKUP_ROUTES    (false)
+/* number of routes for which alternates are kept */
+#define FORWARDING_MAX_BACKUP_ROUTES (8)
+/* number of alternate next hops per route */
+#define FORWARDING_MAX_ALTERNATES   (2)
+
+/**
+ * @brief   Install forwarding_get_next_hop() as routing provider.
+ *          Has to be called after aodv_init().
+ */
+void forwarding_init(void);
+
+/**
+ * @brief   Routing provider: get the next hop towards dest from AODVv2,
+ *          refresh the route if it is about to expire and fail over to an
+ *          alternate next hop or repair it if it is broken.
+ *
+ * @param[in] dest          destination of the packet
+ *
+ * @return  next hop towards dest, NULL if there is none (yet)
+ */
+ipv6_addr_t *forwarding_get_next_hop(ipv6_addr_t *dest);
+
+/**
+ * @brief   Note that this node originates packets towards dest, so that the
+ *          route to dest is refreshed. Routes to the last
+ *          FORWARDING_MAX_LOCAL_DESTS destinations are refreshed, the routes
+ *          this node only forwards along are not.
+ *
+ * @param[in] dest          destination this node sends to
+ */
+void forwarding_add_local_destination(ipv6_addr_t *dest);
+
+/**
+ * @brief   Turn local repair of broken routes on or off.
+ *
+ * @param[in] enable        true to repair locally before sending a RERR
+ */
+void forwarding_set_local_repair(bool enable);
+
+/**
+ * @brief   Turn alternate next hops on or off.
+ *
+ * @param[in] enable        true to keep alternate next hops and fail over to
+ *                          them when a link breaks
+ */
+void forwarding_set_backup_routes(bool enable);
+
+/**
+ * @brief   Print the forwarding counters.
+ */
+void forwarding_print_stats(void);
+
+#endif /* AODVV2_FORWARDING_H_ */
+/** @} */
@@ -4,6 +4,8 @@
 #include <inet_pton.h>
 #include <time.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
 
 #include "thread.h"
 #include "posix_io.h"
@@ -17,6 +19,14 @@
 #include <config.h>
 
 #include "aodvv2/aodvv2.h"
+#include "constants.h"
+#include "routing.h"
+#include "utils.h"
+
+#include "forwarding.h"
+#include "perf.h"
+#include "ratelimit.h"
+#include "routefeed.h"
 
 #define ENABLE_DEBUG (1)
 #include "debug.h"
@@ -25,14 +35,16 @@
 #define UDP_BUFFER_SIZE     (128)
 #define RCV_MSG_Q_SIZE      (64)
 #define DATA_SIZE           (20)
-#define STREAM_INTERVAL     (2000000)     // microseconds
-#define NUM_PKTS            (100)
+#define MAX_BATCH_DESTS     (8)
 
 // constants from the AODVv2 Draft, version 03
 #define DISCOVERY_ATTEMPTS_MAX (3) //(3)
 #define RREQ_WAIT_TIME         (2000000) // microseconds = 2 seconds
 
 int demo_attempt_to_send(char* dest_str, char* msg);
+int demo_attempt_to_send_multi(char** dest_strs, int num_dests, char* msg);
+static bool _needs_discovery(ipv6_addr_t *dest);
+static int _parse_ulong(const char *str, unsigned long *val);
 
 static int _sock_snd, if_id;
 static sockaddr6_t _sockaddr;
@@ -74,45 +86,87 @@ int demo_send_data(int argc, char** argv)
     return demo_attempt_to_send(argv[1], "This is a test");
 }
 
-int  demo_send_stream(int argc, char** argv)
+/*
+    Send the same 20-byte chunk of data as send_data to several addresses at once
+*/
+int demo_send_data_multi(int argc, char** argv)
 {
-    if (argc != 2) {
-        printf("Usage: send_stream <destination ip>\n");
+    if (argc < 2) {
+        printf("Usage: send_data_multi <destination ip> [<destination ip> ...]\n");
         return 1;
     }
 
-    char* dest_str = argv[1];
+    return demo_attempt_to_send_multi(&argv[1], argc - 1, "This is a test");
+}
 
-    int msg_size = sizeof(char)*81;
-    char* msg = (char*) malloc(msg_size);
+/*
+    Send a stream of measurement packets to the address supplied by the user
+*/
+int demo_perf_send(int argc, char** argv)
+{
+    unsigned long pkt_size, rate, duration;
 
-    memset(msg, 'a', msg_size);
-    msg[msg_size - 1] = '\0';
+    if ((argc != 5) || (_parse_ulong(argv[2], &pkt_size) < 0)
+        || (_parse_ulong(argv[3], &rate) < 0) || (_parse_ulong(argv[4], &duration) < 0)) {
+        printf("Usage: perf_send <destination ip> <packet size> <packets per second> <duration in seconds>\n");
+        return 1;
+    }
 
-    /* TODO un-uncomment me
-    if (demo_attempt_to_send(dest_str, msg) < 0 ){
-        printf("[demo]   No route found, can't stream data.\n");
-        return;
+    /* check before narrowing, so that e.g. 65560 doesn't wrap to a valid size */
+    if ((pkt_size < sizeof(struct perf_header)) || (pkt_size > PERF_MAX_PKT_SIZE)
+        || (rate == 0) || (rate > 1000000) || (duration > UINT32_MAX)) {
+        printf("Usage: perf_send <destination ip> <packet size> <packets per second> <duration in seconds>\n");
+        printf("[demo]   packet size must be between %u and %u bytes, rate must be between 1 and 1000000.\n",
+               (unsigned) sizeof(struct perf_header), PERF_MAX_PKT_SIZE);
+        return 1;
     }
-    */
-    inet_pton(AF_INET6, dest_str, &_sockaddr.sin6_addr);
-    int msg_len = strlen(msg)+1;
 
-    vtimer_now(&_now);
-    printf("{%" PRIu32 ":%" PRIu32 "}[demo]   sending stream of %i bytes...\n", _now.seconds, _now.microseconds, sizeof(msg) * strlen(msg));
+    sockaddr6_t dest = { .sin6_family = AF_INET6,
+                         .sin6_port = HTONS(RANDOM_PORT) };
+    inet_pton(AF_INET6, argv[1], &dest.sin6_addr);
+    forwarding_add_local_destination(&dest.sin6_addr);
 
-    for (int i=0; i < NUM_PKTS; i++) {
-        vtimer_now(&_now);
+    if (perf_send(_sock_snd, &dest, (uint16_t) pkt_size, (uint32_t) rate, (uint32_t) duration) < 0) {
+        printf("[demo]   couldn't start the packet stream.\n");
+        return 1;
+    }
+    return 0;
+}
 
-        printf("{%" PRIu32 ":%" PRIu32 "}[demo]   sending packet of %i bytes towards %s...\n", _now.seconds, _now.microseconds, msg_len, dest_str);
+/*
+    Parse a decimal number that makes up all of str. Unlike atoi(), garbage,
+    signs and values that don't fit an unsigned long are rejected.
+*/
+static int _parse_ulong(const char *str, unsigned long *val)
+{
+    char *end;
 
-        socket_base_sendto(_sock_snd, msg, msg_len, 0, &_sockaddr, sizeof _sockaddr);
+    if ((*str < '0') || (*str > '9')) {
+        return -1;
+    }
+    errno = 0;
+    *val = strtoul(str, &end, 10);
+    if ((errno != 0) || (*end != '\0')) {
+        return -1;
+    }
+    return 0;
+}
 
-        vtimer_usleep(STREAM_INTERVAL);
-        printf("%i\n", i);
+/*
+    Print (or reset) the statistics of the last measurement stream this node received
+*/
+int demo_perf_stats(int argc, char** argv)
+{
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        perf_reset_stats();
+        return 0;
+    }
+    if (argc != 1) {
+        printf("Usage: perf_stats [reset]\n");
+        return 1;
     }
-    free(msg);
 
+    perf_print_stats();
     return 0;
 }
 
@@ -186,32 +240,172 @@ int demo_exit(int argc, char** argv)
 
 int demo_attempt_to_send(char* dest_str, char* msg)
 {
-    uint8_t num_attempts = 0;
+    return demo_attempt_to_send_multi(&dest_str, 1, msg);
+}
 
-    // turn dest_str into ipv6_addr_t
-    inet_pton(AF_INET6, dest_str, &_sockaddr.sin6_addr);
+/*
+    Send msg to several destinations. The route discoveries for all destinations
+    are started back to back and share one RREQ_WAIT_TIME per attempt, instead
+    of each destination waiting for the ones before it. Every discovery still
+    takes its own rate limiter token.
+*/
+int demo_attempt_to_send_multi(char** dest_strs, int num_dests, char* msg)
+{
+    uint8_t num_attempts = 0;
+    ipv6_addr_t dests[MAX_BATCH_DESTS];
+    bool done[MAX_BATCH_DESTS];
+    int num_pending = num_dests;
+    int num_failed = 0;
     int msg_len = strlen(msg)+1;
 
-    vtimer_now(&_now);
-    printf("{%" PRIu32 ":%" PRIu32 "}[demo]   sending packet of %i bytes towards %s...\n", _now.seconds, _now.microseconds, msg_len, dest_str);
+    if (num_dests > MAX_BATCH_DESTS) {
+        printf("[demo]   can't send to more than %i destinations at once.\n", MAX_BATCH_DESTS);
+        return -1;
+    }
 
-    while(num_attempts < DISCOVERY_ATTEMPTS_MAX) {
-        int bytes_sent = socket_base_sendto(_sock_snd, msg, msg_len,
-                                                0, &_sockaddr, sizeof _sockaddr);
+    for (int i = 0; i < num_dests; i++) {
+        // turn dest_str into ipv6_addr_t
+        inet_pton(AF_INET6, dest_strs[i], &dests[i]);
+        done[i] = false;
+        forwarding_add_local_destination(&dests[i]);
 
         vtimer_now(&_now);
-        if (bytes_sent == -1) {
-            printf("{%" PRIu32 ":%" PRIu32 "}[demo]   no bytes sent, probably because there is no route yet.\n", _now.seconds, _now.microseconds);
+        printf("{%" PRIu32 ":%" PRIu32 "}[demo]   sending packet of %i bytes towards %s...\n", _now.seconds, _now.microseconds, msg_len, dest_strs[i]);
+    }
+
+    while(num_pending > 0 && num_attempts < DISCOVERY_ATTEMPTS_MAX) {
+        for (int i = 0; i < num_dests; i++) {
+            if (done[i]) {
+                continue;
+            }
+            _sockaddr.sin6_addr = dests[i];
+
+            // sending without a route makes AODVv2 originate a RREQ, which is subject to rate limiting.
+            // only the destinations that get no token are dropped.
+            if (_needs_discovery(&_sockaddr.sin6_addr)) {
+                int32_t delay = ratelimit_acquire(RATELIMIT_RREQ_ORIG);
+                if (delay < 0) {
+                    vtimer_now(&_now);
+                    printf("{%" PRIu32 ":%" PRIu32 "}[demo]   route discovery towards %s throttled, dropping packet.\n", _now.seconds, _now.microseconds, dest_strs[i]);
+                    done[i] = true;
+                    num_pending--;
+                    num_failed++;
+                    continue;
+                }
+                if (delay > 0) {
+                    vtimer_usleep(delay);
+                }
+            }
+
+            int bytes_sent = socket_base_sendto(_sock_snd, msg, msg_len,
+                                                    0, &_sockaddr, sizeof _sockaddr);
+
+            vtimer_now(&_now);
+            if (bytes_sent == -1) {
+                printf("{%" PRIu32 ":%" PRIu32 "}[demo]   no bytes sent to %s, probably because there is no route yet.\n", _now.seconds, _now.microseconds, dest_strs[i]);
+            }
+            else {
+                printf("{%" PRIu32 ":%" PRIu32 "}[demo]   Success sending Data: %d bytes sent to %s.\n", _now.seconds, _now.microseconds, bytes_sent, dest_strs[i]);
+                done[i] = true;
+                num_pending--;
+            }
+        }
+
+        if (num_pending > 0) {
             num_attempts++;
             vtimer_usleep(RREQ_WAIT_TIME);
         }
-        else {
-            printf("{%" PRIu32 ":%" PRIu32 "}[demo]   Success sending Data: %d bytes sent.\n", _now.seconds, _now.microseconds, bytes_sent);
-            return 0;
-        }
     }
     //printf("{%" PRIu32 ":%" PRIu32 "}[demo]  Error sending Data: no route found\n", _now.seconds, _now.microseconds);
-    return -1;
+    return (num_pending + num_failed > 0) ? -1 : 0;
+}
+
+/*
+    Print the RREQ/RERR rate limiter counters or change the limits of one class
+*/
+int demo_ratelimit(int argc, char** argv)
+{
+    unsigned long rate, burst, max_delay_ms;
+
+    if (argc == 1) {
+        ratelimit_print_stats();
+        return 0;
+    }
+    /* the delay is checked before it is converted to us, so that it can't wrap */
+    if ((argc != 5) || (_parse_ulong(argv[2], &rate) < 0) || (_parse_ulong(argv[3], &burst) < 0)
+        || (_parse_ulong(argv[4], &max_delay_ms) < 0) || (rate > 1000000) || (burst > UINT32_MAX)
+        || (max_delay_ms > UINT32_MAX / 1000)) {
+        printf("Usage: ratelimit [<rreq_orig|rerr> <rate per second> <burst> <max delay in ms>]\n");
+        printf("[demo]   rate must be at most 1000000, max delay at most %" PRIu32 " ms.\n",
+               UINT32_MAX / 1000);
+        return 1;
+    }
+
+    ratelimit_class_t cls = ratelimit_class_from_str(argv[1]);
+    if (cls == RATELIMIT_NUMOF) {
+        printf("[demo]   unknown message class %s\n", argv[1]);
+        return 1;
+    }
+
+    ratelimit_configure(cls, (uint32_t) rate, (uint32_t) burst, (uint32_t) max_delay_ms * 1000);
+    return 0;
+}
+
+int demo_forwarding_stats(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    forwarding_print_stats();
+    return 0;
+}
+
+int demo_local_repair(int argc, char** argv)
+{
+    if (argc != 2 || (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0)) {
+        printf("Usage: local_repair <on|off>\n");
+        return 1;
+    }
+
+    forwarding_set_local_repair(strcmp(argv[1], "on") == 0);
+    return 0;
+}
+
+int demo_backup_routes(int argc, char** argv)
+{
+    if (argc != 2 || (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0)) {
+        printf("Usage: backup_routes <on|off>\n");
+        return 1;
+    }
+
+    forwarding_set_backup_routes(strcmp(argv[1], "on") == 0);
+    return 0;
+}
+
+/*
+    Print the routing table changes since the last call (or since event <id>),
+    followed by the id to continue from
+*/
+int demo_route_events(int argc, char** argv)
+{
+    static uint32_t next_id;
+
+    if (argc > 2) {
+        printf("Usage: rt_events [id]\n");
+        return 1;
+    }
+    if (argc == 2) {
+        unsigned long id;
+        if ((_parse_ulong(argv[1], &id) < 0) || (id > UINT32_MAX) || routefeed_is_ahead(id)) {
+            printf("[demo]   no event %s yet, the next one is %" PRIu32 ".\n", argv[1], routefeed_next_id());
+            return 1;
+        }
+        next_id = id;
+    }
+
+    routefeed_update_all();
+    next_id = routefeed_print(next_id);
+    printf("next %" PRIu32 "\n", next_id);
+    return 0;
 }
 
 int demo_print_routingtable(int argc, char** argv)
@@ -222,6 +416,23 @@ int demo_print_routingtable(int argc, char** argv)
     return 0;
 }
 
+/*
+    Check if sending to dest would make AODVv2 start a route discovery, i.e. if
+    dest is neither a neighbor nor in the routing table
+*/
+static bool _needs_discovery(ipv6_addr_t *dest)
+{
+    struct netaddr na_dest;
+    ndp_neighbor_cache_t* nc_entry = ndp_neighbor_cache_search(dest);
+
+    if (nc_entry && nc_entry->state == NDP_NCE_STATUS_REACHABLE) {
+        return false;
+    }
+
+    ipv6_addr_t_to_netaddr(dest, &na_dest);
+    return (routingtable_get_entry(&na_dest, AODVV2_DEFAULT_METRIC_TYPE) == NULL);
+}
+
 static void _demo_init_socket(void)
 {
     _sockaddr.sin6_family = AF_INET6;
@@ -270,6 +481,10 @@ static void *_demo_receiver_thread(void *arg)
         if(rcv_size < 0) {
             DEBUG("{%" PRIu32 ":%" PRIu32 "}[demo]   ERROR receiving data!\n", _now2.seconds, _now2.microseconds);
         }
+        else if (perf_receive(buf_rcv, rcv_size, &sa_rcv.sin6_addr)) {
+            // measurement packets are only accounted for, logging each of them would skew the results
+            continue;
+        }
         DEBUG("{%" PRIu32 ":%" PRIu32 "}[demo]   UDP packet received from %s: %s\n", _now2.seconds, _now2.microseconds, ipv6_addr_to_str(addr_str_rec, IPV6_MAX_ADDR_STR_LEN, &sa_rcv.sin6_addr), buf_rcv);
     }
 
@@ -287,23 +502,36 @@ static void _init_tlayer(void)
     printf("initializing 6LoWPAN...\n");
 
     ipv6_addr_init(&prefix, 0xABCD, 0xEF12, 0, 0, 0, 0, 0, 0);
-    if_id = 0; // >1 interface isn't supported anyway, so there
+    /* the demo drives a single radio. Nodes with several interfaces can only
+     * be simulated, see virtualnetwork.h */
+    if_id = 0;
 
     //sixlowpan_lowpan_init_adhoc_interface(if_id, &prefix);
     sixlowpan_lowpan_init_interface(if_id);
     printf("initializing AODVv2...\n");
 
     aodv_init();
+    routefeed_init();
+    forwarding_init();
+    ratelimit_init();
+    perf_init();
     _demo_init_socket();
 }
 
 const shell_command_t shell_commands[] = {
     {"print_rt", "print routingtable", demo_print_routingtable},
+    {"rt_events", "print routingtable changes since the last call", demo_route_events},
     {"send", "send message to ip", demo_send},
     {"send_data", "send 20 bytes of data to ip", demo_send_data},
-    {"send_stream", "send stream of data to ip", demo_send_stream},
+    {"send_data_multi", "send 20 bytes of data to several ips, discovering routes in parallel", demo_send_data_multi},
+    {"perf_send", "send stream of measurement packets to ip", demo_perf_send},
+    {"perf_stats", "print statistics of the last received measurement stream", demo_perf_stats},
     {"add_neighbor", "add neighbor to Neighbor Cache", demo_add_neighbor},
     {"rm_neighbor", "remove neighbor from Neighbor Cache", demo_remove_neighbor},
+    {"ratelimit", "show or set RREQ/RERR rate limits", demo_ratelimit},
+    {"fwd_stats", "print forwarding counters (route refreshes, local repairs, failovers)", demo_forwarding_stats},
+    {"local_repair", "repair broken routes locally before sending a RERR", demo_local_repair},
+    {"backup_routes", "keep alternate next hops for instant failover", demo_backup_routes},
     {"exit", "Shut down the RIOT", demo_exit},
     {NULL, NULL, NULL}
 };
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     aodvv2
+ * @{
+ *
+ * @file        perf.c
+ * @brief       throughput and latency measurement for the AODVv2 demo
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mutex.h"
+#include "vtimer.h"
+#include "net_help.h"
+#include "inet_ntop.h"
+
+#include "perf.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+struct perf_stream_stats {
+    bool active;
+    ipv6_addr_t source;
+    uint16_t stream_id;
+    uint16_t pkt_size;
+    uint32_t received;
+    uint32_t bytes;
+    uint32_t reordered;
+    uint32_t max_seqnum;
+    uint64_t first_rx;          /* microseconds */
+    uint64_t last_rx;           /* microseconds */
+    int64_t last_delay;         /* microseconds */
+    int64_t jitter;             /* RFC 3550 interarrival jitter, scaled by 16 */
+    int32_t delays[PERF_MAX_SAMPLES];
+    int32_t delay_variations[PERF_MAX_SAMPLES];
+};
+
+static struct perf_stream_stats _stats;
+static mutex_t _mutex;
+static uint16_t _stream_id;
+static char _addr_str[IPV6_MAX_ADDR_STR_LEN];
+
+static uint64_t _now_us(void);
+static void _start_stream(ipv6_addr_t *source, struct perf_header *hdr);
+static void _print_percentiles(const char *name, const int32_t *samples, uint32_t num_samples);
+static int _cmp_int32(const void *a, const void *b);
+
+void perf_init(void)
+{
+    mutex_init(&_mutex);
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+int perf_send(int sock, sockaddr6_t *dest, uint16_t pkt_size, uint32_t rate,
+              uint32_t duration)
+{
+    char buf[PERF_MAX_PKT_SIZE];
+    struct perf_header *hdr = (struct perf_header *) buf;
+    timex_t now;
+    uint32_t seqnum = 0, num_sent = 0, num_failed = 0;
+
+    if ((pkt_size < sizeof(struct perf_header)) || (pkt_size > PERF_MAX_PKT_SIZE)
+        || (rate == 0) || (rate > 1000000)) {
+        return -1;
+    }
+
+    memset(buf, 'a', pkt_size);
+    _stream_id++;
+    hdr->magic = HTONL(PERF_MAGIC);
+    hdr->stream_id = HTONS(_stream_id);
+    hdr->pkt_size = HTONS(pkt_size);
+
+    uint32_t interval = 1000000 / rate;
+    uint64_t start = _now_us();
+    uint64_t end = start + (uint64_t) duration * 1000000;
+
+    /* packets are scheduled relative to the start of the stream so that the
+     * time spent sending doesn't add up to a lower rate */
+    for (uint64_t next = start; next < end; next += interval) {
+        vtimer_now(&now);
+        hdr->seqnum = HTONL(seqnum);
+        hdr->sent_s = HTONL(now.seconds);
+        hdr->sent_us = HTONL(now.microseconds);
+        seqnum++;
+
+        if (socket_base_sendto(sock, buf, pkt_size, 0, dest, sizeof(*dest)) == -1) {
+            num_failed++;
+        }
+        else {
+            num_sent++;
+        }
+
+        uint64_t after = _now_us();
+        if (next + interval > after) {
+            vtimer_usleep(next + interval - after);
+        }
+    }
+
+    printf("[perf]   stream %" PRIu16 " towards %s: %" PRIu32 " packets of %" PRIu16
+           " bytes sent, %" PRIu32 " not sent, took %" PRIu32 " ms\n", _stream_id,
+           ipv6_addr_to_str(_addr_str, IPV6_MAX_ADDR_STR_LEN, &dest->sin6_addr),
+           num_sent, pkt_size, num_failed, (uint32_t)((_now_us() - start) / 1000));
+
+    return num_sent;
+}
+
+bool perf_receive(const void *buf, int32_t len, ipv6_addr_t *from)
+{
+    struct perf_header hdr;
+
+    if (len < (int32_t) sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (NTOHL(hdr.magic) != PERF_MAGIC) {
+        return false;
+    }
+
+    uint64_t now = _now_us();
+    uint32_t seqnum = NTOHL(hdr.seqnum);
+    uint64_t sent = (uint64_t) NTOHL(hdr.sent_s) * 1000000 + NTOHL(hdr.sent_us);
+    int64_t delay = (int64_t)(now - sent);
+
+    mutex_lock(&_mutex);
+    if (!_stats.active || (NTOHS(hdr.stream_id) != _stats.stream_id)
+        || (memcmp(from, &_stats.source, sizeof(*from)) != 0)) {
+        _start_stream(from, &hdr);
+        _stats.first_rx = now;
+    }
+    else {
+        /* RFC 3550, section 6.4.1 */
+        int64_t d = delay - _stats.last_delay;
+        if (d < 0) {
+            d = -d;
+        }
+        _stats.jitter += d - ((_stats.jitter + 8) >> 4);
+        _stats.delay_variations[(_stats.received - 1) % PERF_MAX_SAMPLES] = (int32_t) d;
+    }
+
+    if ((_stats.received > 0) && (seqnum < _stats.max_seqnum)) {
+        _stats.reordered++;
+    }
+    else {
+        _stats.max_seqnum = seqnum;
+    }
+
+    _stats.delays[_stats.received % PERF_MAX_SAMPLES] = (int32_t) delay;
+    _stats.last_delay = delay;
+    _stats.last_rx = now;
+    _stats.bytes += len;
+    _stats.received++;
+    mutex_unlock(&_mutex);
+
+    DEBUG("[perf]   packet %" PRIu32 " of stream %" PRIu16 " received\n", seqnum,
+          NTOHS(hdr.stream_id));
+    return true;
+}
+
+void perf_print_stats(void)
+{
+    mutex_lock(&_mutex);
+    if (!_stats.active) {
+        mutex_unlock(&_mutex);
+        printf("[perf]   no stream received yet.\n");
+        return;
+    }
+
+    uint32_t expected = _stats.max_seqnum + 1;
+    uint32_t lost = (expected > _stats.received) ? expected - _stats.received : 0;
+    uint32_t loss_permille = (uint32_t)((uint64_t) lost * 1000 / expected);
+    uint64_t elapsed = _stats.last_rx - _stats.first_rx;
+    uint32_t goodput = (elapsed > 0) ? (uint32_t)((uint64_t) _stats.bytes * 8 * 1000000 / elapsed) : 0;
+    uint32_t num_delays = (_stats.received < PERF_MAX_SAMPLES) ? _stats.received : PERF_MAX_SAMPLES;
+    uint32_t num_variations = (_stats.received - 1 < PERF_MAX_SAMPLES) ? _stats.received - 1 : PERF_MAX_SAMPLES;
+
+    printf("[perf]   stream %" PRIu16 " from %s (%" PRIu16 " byte packets):\n",
+           _stats.stream_id, ipv6_addr_to_str(_addr_str, IPV6_MAX_ADDR_STR_LEN, &_stats.source),
+           _stats.pkt_size);
+    printf("\treceived: %" PRIu32 " of %" PRIu32 " packets, lost: %" PRIu32 " (%" PRIu32
+           ".%" PRIu32 " %%), reordered: %" PRIu32 "\n", _stats.received, expected, lost,
+           loss_permille / 10, loss_permille % 10, _stats.reordered);
+    printf("\tgoodput: %" PRIu32 " bit/s over %" PRIu32 " ms\n", goodput, (uint32_t)(elapsed / 1000));
+    _print_percentiles("one-way delay", _stats.delays, num_delays);
+    _print_percentiles("delay variation", _stats.delay_variations, num_variations);
+    printf("\tjitter (RFC 3550): %" PRIi32 " us\n", (int32_t)(_stats.jitter >> 4));
+    mutex_unlock(&_mutex);
+}
+
+void perf_reset_stats(void)
+{
+    mutex_lock(&_mutex);
+    memset(&_stats, 0, sizeof(_stats));
+    mutex_unlock(&_mutex);
+}
+
+static uint64_t _now_us(void)
+{
+    timex_t now;
+    vtimer_now(&now);
+    return timex_uint64(now);
+}
+
+static void _start_stream(ipv6_addr_t *source, struct perf_header *hdr)
+{
+    memset(&_stats, 0, sizeof(_stats));
+    _stats.active = true;
+    _stats.source = *source;
+    _stats.stream_id = NTOHS(hdr->stream_id);
+    _stats.pkt_size = NTOHS(hdr->pkt_size);
+}
+
+/* print min, 50th, 90th and 99th percentile and max of the (most recent) samples */
+static void _print_percentiles(const char *name, const int32_t *samples, uint32_t num_samples)
+{
+    int32_t sorted[PERF_MAX_SAMPLES];
+
+    if (num_samples == 0) {
+        printf("\t%s: no samples\n", name);
+        return;
+    }
+
+    memcpy(sorted, samples, num_samples * sizeof(int32_t));
+    qsort(sorted, num_samples, sizeof(int32_t), _cmp_int32);
+
+    printf("\t%s (us): min %" PRIi32 ", p50 %" PRIi32 ", p90 %" PRIi32 ", p99 %" PRIi32
+           ", max %" PRIi32 "\n", name, sorted[0], sorted[(num_samples - 1) * 50 / 100],
+           sorted[(num_samples - 1) * 90 / 100], sorted[(num_samples - 1) * 99 / 100],
+           sorted[num_samples - 1]);
+}
+
+static int _cmp_int32(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *) a;
+    int32_t y = *(const int32_t *) b;
+    return (x > y) - (x < y);
+}
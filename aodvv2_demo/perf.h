@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     aodvv2
+ * @{
+ *
+ * @file        perf.h
+ * @brief       throughput and latency measurement for the AODVv2 demo
+ *
+ * The sender emits a stream of UDP packets at a fixed rate. Each packet
+ * starts with a perf_header carrying the stream id, a sequence number and
+ * the time it was sent. The receiver uses them to compute goodput, loss,
+ * reordering, one-way delay and jitter of that stream.
+ *
+ * One-way delays are computed from the clocks of two different nodes and are
+ * therefore offset by the difference between these clocks. Jitter and delay
+ * variation are not affected by that offset.
+ */
+
+#ifndef AODVV2_PERF_H_
+#define AODVV2_PERF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "socket_base/socket.h"
+
+#define PERF_MAGIC          (0x41507266)    /**< "APrf" */
+#define PERF_MAX_PKT_SIZE   (128)           /**< must fit the receive buffer */
+#define PERF_MAX_SAMPLES    (256)           /**< delay samples kept for percentiles */
+
+/**
+ * @brief   header that precedes the payload of every measurement packet.
+ *          All fields are in network byte order.
+ */
+struct perf_header {
+    uint32_t magic;
+    uint16_t stream_id;
+    uint16_t pkt_size;
+    uint32_t seqnum;
+    uint32_t sent_s;
+    uint32_t sent_us;
+} __attribute__((packed));
+
+/**
+ * @brief   Set up the receiver state.
+ */
+void perf_init(void);
+
+/**
+ * @brief   Send a stream of measurement packets. Blocks until the stream is
+ *          finished and prints a summary afterwards.
+ *
+ * @param[in] sock          socket to send through
+ * @param[in] dest          address and port of the receiver
+ * @param[in] pkt_size      size of each packet including the perf_header
+ * @param[in] rate          packets per second
+ * @param[in] duration      length of the stream in seconds
+ *
+ * @return  number of packets handed to the network stack, -1 on error
+ */
+int perf_send(int sock, sockaddr6_t *dest, uint16_t pkt_size, uint32_t rate,
+              uint32_t duration);
+
+/**
+ * @brief   Account for a received packet if it belongs to a measurement
+ *          stream.
+ *
+ * @param[in] buf           packet payload
+ * @param[in] len           payload length
+ * @param[in] from          address of the node the packet came from
+ *
+ * @return  true if buf was a measurement packet, false otherwise
+ */
+bool perf_receive(const void *buf, int32_t len, ipv6_addr_t *from);
+
+/**
+ * @brief   Print the statistics of the last stream that was received.
+ */
+void perf_print_stats(void);
+
+/**
+ * @brief   Forget everything that has been received so far.
+ */
+void perf_reset_stats(void);
+
+#endif /* AODVV2_PERF_H_ */
+/** @} */
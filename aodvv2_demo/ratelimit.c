@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     aodvv2
+ * @{
+ *
+ * @file        ratelimit.c
+ * @brief       token bucket rate limiting for AODVv2 control messages
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mutex.h"
+#include "vtimer.h"
+
+#include "ratelimit.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+/* bucket levels are kept in millionths of a token so that <rate> tokens per
+ * second can be added per elapsed microsecond without rounding */
+#define TOKEN (1000000LL)
+
+struct ratelimit_bucket {
+    uint32_t rate;
+    uint32_t burst;
+    uint32_t max_delay;
+    int64_t level;          /* may become negative while messages are queued */
+    uint64_t last_refill;   /* microseconds */
+    uint32_t passed;
+    uint32_t delayed;
+    uint32_t dropped;
+};
+
+static const char *_class_names[RATELIMIT_NUMOF] = {
+    [RATELIMIT_RREQ_ORIG] = "rreq_orig",
+    [RATELIMIT_RERR] = "rerr",
+};
+
+static struct ratelimit_bucket _buckets[RATELIMIT_NUMOF];
+static mutex_t _mutex;
+
+static uint64_t _now_us(void);
+static void _refill(struct ratelimit_bucket *bucket, uint64_t now);
+
+void ratelimit_init(void)
+{
+    mutex_init(&_mutex);
+
+    ratelimit_configure(RATELIMIT_RREQ_ORIG, RATELIMIT_RREQ_ORIG_RATE,
+                        RATELIMIT_RREQ_ORIG_BURST, RATELIMIT_MAX_DELAY);
+    ratelimit_configure(RATELIMIT_RERR, RATELIMIT_RERR_RATE,
+                        RATELIMIT_RERR_BURST, RATELIMIT_MAX_DELAY);
+}
+
+void ratelimit_configure(ratelimit_class_t cls, uint32_t rate, uint32_t burst,
+                         uint32_t max_delay)
+{
+    if (cls >= RATELIMIT_NUMOF) {
+        return;
+    }
+
+    mutex_lock(&_mutex);
+    struct ratelimit_bucket *bucket = &_buckets[cls];
+    memset(bucket, 0, sizeof(*bucket));
+    bucket->rate = rate;
+    bucket->burst = (burst > 0) ? burst : 1;
+    bucket->max_delay = max_delay;
+    bucket->level = bucket->burst * TOKEN;
+    bucket->last_refill = _now_us();
+    mutex_unlock(&_mutex);
+}
+
+int32_t ratelimit_acquire(ratelimit_class_t cls)
+{
+    int32_t result;
+
+    if (cls >= RATELIMIT_NUMOF) {
+        return -1;
+    }
+
+    mutex_lock(&_mutex);
+    struct ratelimit_bucket *bucket = &_buckets[cls];
+
+    if (bucket->rate == 0) {
+        bucket->passed++;
+        mutex_unlock(&_mutex);
+        return 0;
+    }
+
+    _refill(bucket, _now_us());
+
+    if (bucket->level >= TOKEN) {
+        bucket->level -= TOKEN;
+        bucket->passed++;
+        result = 0;
+    }
+    else {
+        /* time until the bucket (including all tokens already promised to
+         * queued messages) holds one more token */
+        int64_t wait = (TOKEN - bucket->level + bucket->rate - 1) / bucket->rate;
+
+        if (wait <= bucket->max_delay) {
+            bucket->level -= TOKEN;
+            bucket->delayed++;
+            result = (int32_t) wait;
+        }
+        else {
+            bucket->dropped++;
+            result = -1;
+        }
+    }
+    mutex_unlock(&_mutex);
+
+    DEBUG("[ratelimit] %s: %" PRIi32 "\n", _class_names[cls], result);
+    return result;
+}
+
+bool ratelimit_try_acquire(ratelimit_class_t cls)
+{
+    bool result;
+
+    if (cls >= RATELIMIT_NUMOF) {
+        return false;
+    }
+
+    mutex_lock(&_mutex);
+    struct ratelimit_bucket *bucket = &_buckets[cls];
+
+    if (bucket->rate > 0) {
+        _refill(bucket, _now_us());
+    }
+
+    result = (bucket->rate == 0) || (bucket->level >= TOKEN);
+    if (result) {
+        if (bucket->rate > 0) {
+            bucket->level -= TOKEN;
+        }
+        bucket->passed++;
+    }
+    else {
+        bucket->dropped++;
+    }
+    mutex_unlock(&_mutex);
+
+    DEBUG("[ratelimit] %s: %s\n", _class_names[cls], result ? "passed" : "dropped");
+    return result;
+}
+
+ratelimit_class_t ratelimit_class_from_str(const char *name)
+{
+    for (int i = 0; i < RATELIMIT_NUMOF; i++) {
+        if (strcmp(name, _class_names[i]) == 0) {
+            return (ratelimit_class_t) i;
+        }
+    }
+    return RATELIMIT_NUMOF;
+}
+
+void ratelimit_print_stats(void)
+{
+    mutex_lock(&_mutex);
+    printf("class      rate/s  burst  max delay (us)  passed  delayed  dropped\n");
+    for (int i = 0; i < RATELIMIT_NUMOF; i++) {
+        struct ratelimit_bucket *bucket = &_buckets[i];
+        printf("%-9s  %6" PRIu32 "  %5" PRIu32 "  %14" PRIu32 "  %6" PRIu32 "  %7" PRIu32 "  %7" PRIu32 "\n",
+               _class_names[i], bucket->rate, bucket->burst, bucket->max_delay,
+               bucket->passed, bucket->delayed, bucket->dropped);
+    }
+    mutex_unlock(&_mutex);
+}
+
+static uint64_t _now_us(void)
+{
+    timex_t now;
+    vtimer_now(&now);
+    return timex_uint64(now);
+}
+
+static void _refill(struct ratelimit_bucket *bucket, uint64_t now)
+{
+    int64_t max_level = bucket->burst * TOKEN;
+
+    bucket->level += (int64_t)(now - bucket->last_refill) * bucket->rate;
+    if (bucket->level > max_level) {
+        bucket->level = max_level;
+    }
+    bucket->last_refill = now;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     aodvv2
+ * @{
+ *
+ * @file        ratelimit.h
+ * @brief       token bucket rate limiting for AODVv2 control messages
+ *
+ * Every class of control message gets its own bucket which is refilled with
+ * <rate> tokens per second up to <burst> tokens. A message that finds the
+ * bucket empty is either delayed until its token becomes available (if that
+ * happens within <max_delay>) or dropped. Since the decision only depends on
+ * the bucket state, the same sequence of requests is always throttled the
+ * same way.
+ *
+ * Forwarded RREQs are not limited here: they are sent by the aodvv2 module
+ * itself and never pass through the demo.
+ */
+
+#ifndef AODVV2_RATELIMIT_H_
+#define AODVV2_RATELIMIT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* default limits per class. A rate of 0 disables limiting for that class. */
+#define RATELIMIT_RREQ_ORIG_RATE      (1)        /**< RREQs originated per second */
+#define RATELIMIT_RREQ_ORIG_BURST     (3)
+#define RATELIMIT_RERR_RATE           (2)        /**< RERRs sent per second */
+#define RATELIMIT_RERR_BURST          (5)
+#define RATELIMIT_MAX_DELAY           (2000000)  /**< microseconds */
+
+/**
+ * @brief   classes of control messages with separate budgets
+ */
+typedef enum {
+    RATELIMIT_RREQ_ORIG = 0,
+    RATELIMIT_RERR,
+    RATELIMIT_NUMOF
+} ratelimit_class_t;
+
+/**
+ * @brief   Set up all buckets with their default limits and reset the
+ *          counters.
+ */
+void ratelimit_init(void);
+
+/**
+ * @brief   Change the limits of one class. The bucket starts out full.
+ *
+ * @param[in] cls           class to configure
+ * @param[in] rate          tokens added per second (0 = unlimited)
+ * @param[in] burst         maximum number of tokens in the bucket
+ * @param[in] max_delay     longest time (in microseconds) a message may be
+ *                          held back before it is dropped instead
+ */
+void ratelimit_configure(ratelimit_class_t cls, uint32_t rate, uint32_t burst,
+                         uint32_t max_delay);
+
+/**
+ * @brief   Take a token for one message of class cls.
+ *
+ * @param[in] cls           class of the message that is about to be sent
+ *
+ * @return  0 if the message may be sent right away,
+ *          the number of microseconds the caller has to wait before sending
+ *          if the message was queued,
+ *          -1 if the message has to be dropped.
+ */
+int32_t ratelimit_acquire(ratelimit_class_t cls);
+
+/**
+ * @brief   Take a token for one message of class cls only if one is available
+ *          right now. Never queues, so it can be used in contexts that must
+ *          not block.
+ *
+ * @param[in] cls           class of the message that is about to be sent
+ *
+ * @return  true if the message may be sent, false if it has to be dropped
+ */
+bool ratelimit_try_acquire(ratelimit_class_t cls);
+
+/**
+ * @brief   Parse a class name as used on the shell ("rreq_orig", "rerr").
+ *
+ * @return  the class, RATELIMIT_NUMOF if the name is unknown
+ */
+ratelimit_class_t ratelimit_class_from_str(const char *name);
+
+/**
+ * @brief   Print limits and counters of all classes.
+ */
+void ratelimit_print_stats(void);
+
+#endif /* AODVV2_RATELIMIT_H_ */
+/** @} */
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     aodvv2
+ * @{
+ *
+ * @file        routefeed.c
+ * @brief       stream of routing table changes
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mutex.h"
+#include "vtimer.h"
+
+#include "constants.h"
+#include "routing.h"
+
+#include "routefeed.h"
+
+/* the state of a route as it was last published */
+struct routefeed_route {
+    bool active;
+    bool present;               /* route existed and hadn't expired */
+    struct netaddr addr;
+    struct netaddr nextHopAddr;
+    uint16_t seqnum;
+    uint8_t metric;
+    uint8_t state;
+};
+
+static struct routefeed_event _ring[ROUTEFEED_RING_LEN];
+static uint32_t _next_id;
+static uint32_t _num_events;    /* events in the ring, at most ROUTEFEED_RING_LEN */
+static struct routefeed_route _routes[ROUTEFEED_MAX_ROUTES];
+static unsigned _next_route;
+static mutex_t _mutex;
+
+static const char *_type_names[] = {
+    [ROUTEFEED_ADD] = "add",
+    [ROUTEFEED_UPDATE] = "update",
+    [ROUTEFEED_BREAK] = "break",
+    [ROUTEFEED_EXPIRE] = "expire",
+};
+
+static struct routefeed_route *_find_route(struct netaddr *addr);
+static struct routefeed_route *_get_route(struct netaddr *addr);
+static void _update(struct routefeed_route *route);
+static void _publish(routefeed_type_t type, struct routefeed_route *route);
+
+void routefeed_init(void)
+{
+    mutex_init(&_mutex);
+    memset(_routes, 0, sizeof(_routes));
+    _next_id = 0;
+    _num_events = 0;
+}
+
+void routefeed_update(struct netaddr *addr)
+{
+    mutex_lock(&_mutex);
+    struct routefeed_route *route = _find_route(addr);
+
+    /* destinations without a route, e.g. neighbors, would only push real
+     * routes out of the table */
+    if (!route && routingtable_get_entry(addr, AODVV2_DEFAULT_METRIC_TYPE)) {
+        route = _get_route(addr);
+    }
+    if (route) {
+        _update(route);
+    }
+    mutex_unlock(&_mutex);
+}
+
+void routefeed_update_all(void)
+{
+    mutex_lock(&_mutex);
+    for (unsigned i = 0; i < ROUTEFEED_MAX_ROUTES; i++) {
+        if (_routes[i].active) {
+            _update(&_routes[i]);
+        }
+    }
+    mutex_unlock(&_mutex);
+}
+
+uint32_t routefeed_next_id(void)
+{
+    return _next_id;
+}
+
+bool routefeed_get(uint32_t id, struct routefeed_event *event)
+{
+    mutex_lock(&_mutex);
+    /* unsigned arithmetic keeps this correct when the ids wrap around */
+    uint32_t age = _next_id - id;
+    bool found = (age >= 1) && (age <= _num_events);
+    if (found) {
+        *event = _ring[id % ROUTEFEED_RING_LEN];
+    }
+    mutex_unlock(&_mutex);
+    return found;
+}
+
+uint32_t routefeed_print(uint32_t id)
+{
+    struct routefeed_event event;
+    struct netaddr_str nbuf, nbuf2;
+    uint32_t next_id = routefeed_next_id();
+
+    if (routefeed_is_ahead(id)) {
+        return next_id;
+    }
+
+    if ((next_id - id) > ROUTEFEED_RING_LEN) {
+        printf("lost %" PRIu32 "\n", next_id - id - ROUTEFEED_RING_LEN);
+        id = next_id - ROUTEFEED_RING_LEN;
+    }
+
+    for (; id != next_id; id++) {
+        if (!routefeed_get(id, &event)) {
+            continue;
+        }
+        printf("%" PRIu32 " %s %s %s %u %u\n", event.id, _type_names[event.type],
+               netaddr_to_string(&nbuf, &event.addr),
+               netaddr_to_string(&nbuf2, &event.nextHopAddr),
+               event.metric, event.seqnum);
+    }
+    return next_id;
+}
+
+bool routefeed_is_ahead(uint32_t id)
+{
+    /* unsigned arithmetic keeps this correct when the ids wrap around */
+    return (int32_t)(id - routefeed_next_id()) > 0;
+}
+
+static struct routefeed_route *_find_route(struct netaddr *addr)
+{
+    for (unsigned i = 0; i < ROUTEFEED_MAX_ROUTES; i++) {
+        if (_routes[i].active && (netaddr_cmp(&_routes[i].addr, addr) == 0)) {
+            return &_routes[i];
+        }
+    }
+    return NULL;
+}
+
+/* start observing the route to addr. Slots of routes that are gone are
+ * reused first; if all routes are present, the oldest one is replaced and
+ * reported as expired, since its changes won't be published anymore. */
+static struct routefeed_route *_get_route(struct netaddr *addr)
+{
+    struct routefeed_route *route = NULL;
+
+    for (unsigned i = 0; (i < ROUTEFEED_MAX_ROUTES) && !route; i++) {
+        if (!_routes[i].active || !_routes[i].present) {
+            route = &_routes[i];
+        }
+    }
+
+    if (!route) {
+        route = &_routes[_next_route];
+        _next_route = (_next_route + 1) % ROUTEFEED_MAX_ROUTES;
+        route->present = false;
+        _publish(ROUTEFEED_EXPIRE, route);
+    }
+
+    memset(route, 0, sizeof(*route));
+    route->active = true;
+    route->addr = *addr;
+    return route;
+}
+
+static void _update(struct routefeed_route *route)
+{
+    struct aodvv2_routing_entry_t *entry = routingtable_get_entry(&route->addr,
+                                                                  AODVV2_DEFAULT_METRIC_TYPE);
+    timex_t now;
+    vtimer_now(&now);
+
+    if (!entry || (timex_cmp(entry->expirationTime, now) < 0)) {
+        if (route->present) {
+            route->present = false;
+            _publish(ROUTEFEED_EXPIRE, route);
+        }
+        return;
+    }
+
+    bool was_present = route->present;
+    bool changed = (netaddr_cmp(&route->nextHopAddr, &entry->nextHopAddr) != 0)
+                   || (route->seqnum != entry->seqnum)
+                   || (route->metric != entry->metric)
+                   || ((route->state == ROUTE_STATE_BROKEN) && (entry->state != ROUTE_STATE_BROKEN));
+    bool broke = (entry->state == ROUTE_STATE_BROKEN) && (route->state != ROUTE_STATE_BROKEN);
+
+    route->present = true;
+    route->nextHopAddr = entry->nextHopAddr;
+    route->seqnum = entry->seqnum;
+    route->metric = entry->metric;
+    route->state = entry->state;
+
+    if (!was_present) {
+        _publish((entry->state == ROUTE_STATE_BROKEN) ? ROUTEFEED_BREAK : ROUTEFEED_ADD, route);
+    }
+    else if (broke) {
+        _publish(ROUTEFEED_BREAK, route);
+    }
+    else if (changed) {
+        _publish(ROUTEFEED_UPDATE, route);
+    }
+}
+
+static void _publish(routefeed_type_t type, struct routefeed_route *route)
+{
+    struct routefeed_event *event = &_ring[_next_id % ROUTEFEED_RING_LEN];
+
+    event->id = _next_id++;
+    if (_num_events < ROUTEFEED_RING_LEN) {
+        _num_events++;
+    }
+    event->type = type;
+    event->addr = route->addr;
+    event->nextHopAddr = route->nextHopAddr;
+    event->seqnum = route->seqnum;
+    event->metric = route->metric;
+}
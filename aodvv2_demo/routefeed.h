@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     aodvv2
+ * @{
+ *
+ * @file        routefeed.h
+ * @brief       stream of routing table changes
+ *
+ * Instead of dumping the whole routing table, consumers read the changes to
+ * it: a route was added, updated (new next hop, metric or SeqNum), broke or
+ * expired. Changes are kept in a ring of ROUTEFEED_RING_LEN events, each with
+ * an increasing id. A consumer remembers the id of the next event it wants and
+ * asks for everything from there; if it fell so far behind that events were
+ * overwritten, it learns how many it missed and can fall back to print_rt.
+ *
+ * The feed only covers routes that have been used: a route is observed from
+ * the first time a packet is routed towards its destination. aodvv2 can't be
+ * asked for all entries of its routing table, so routes it installs while
+ * handling RREQs and RREPs (e.g. on intermediate nodes) aren't reported until
+ * traffic takes them (see tests/test_routefeed.c); print_rt shows those. Once
+ * observed, a route is checked whenever a packet is routed towards it and
+ * whenever the feed is read, so a route that expires without carrying traffic
+ * is reported on the next read. If ROUTEFEED_MAX_ROUTES routes are observed
+ * already, the oldest one is dropped and reported as expired.
+ */
+
+#ifndef AODVV2_ROUTEFEED_H_
+#define AODVV2_ROUTEFEED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common/netaddr.h"
+
+/* number of events kept for consumers */
+#define ROUTEFEED_RING_LEN          (64)
+/* number of destinations whose routes are observed */
+#define ROUTEFEED_MAX_ROUTES        (32)
+
+/**
+ * @brief   kinds of route changes
+ */
+typedef enum {
+    ROUTEFEED_ADD,
+    ROUTEFEED_UPDATE,
+    ROUTEFEED_BREAK,
+    ROUTEFEED_EXPIRE,
+} routefeed_type_t;
+
+/**
+ * @brief   a route change, with the state of the route after the change
+ */
+struct routefeed_event {
+    uint32_t id;
+    routefeed_type_t type;
+    struct netaddr addr;
+    struct netaddr nextHopAddr;
+    uint16_t seqnum;
+    uint8_t metric;
+};
+
+/**
+ * @brief   Start with an empty feed.
+ */
+void routefeed_init(void);
+
+/**
+ * @brief   Compare the route to addr with its last known state and publish
+ *          the difference. Routes that haven't been observed before are
+ *          observed from now on if the routing table has an entry for addr.
+ *
+ * @param[in] addr          destination of the route
+ */
+void routefeed_update(struct netaddr *addr);
+
+/**
+ * @brief   routefeed_update() for all observed routes.
+ */
+void routefeed_update_all(void);
+
+/**
+ * @brief   Get the id the next event will have.
+ */
+uint32_t routefeed_next_id(void);
+
+/**
+ * @brief   Check if id is ahead of the newest event, i.e. it hasn't been
+ *          handed out by routefeed_next_id() yet.
+ */
+bool routefeed_is_ahead(uint32_t id);
+
+/**
+ * @brief   Get an event from the ring.
+ *
+ * @param[in]  id           id of the event
+ * @param[out] event        the event
+ *
+ * @return  true if the event exists, false if it hasn't happened yet or has
+ *          been overwritten already
+ */
+bool routefeed_get(uint32_t id, struct routefeed_event *event);
+
+/**
+ * @brief   Print all events starting at id, one per line:
+ *          <id> <add|update|break|expire> <addr> <next hop> <metric> <seqnum>
+ *
+ * @param[in] id            first event to print, nothing is printed if
+ *                          routefeed_is_ahead(id)
+ *
+ * @return  id of the first event that hasn't been printed
+ */
+uint32_t routefeed_print(uint32_t id);
+
+#endif /* AODVV2_ROUTEFEED_H_ */
+/** @} */
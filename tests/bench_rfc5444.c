@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     tests
+ * @{
+ *
+ * @file        bench_rfc5444.c
+ * @brief       throughput of the AODVv2 RFC 5444 writer and reader
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "vtimer.h"
+
+#include "constants.h"
+#include "reader.h"
+#include "routing.h"
+#include "utils.h"
+#include "writer.h"
+
+#include "common/netaddr.h"
+
+#include "bench_rfc5444.h"
+
+typedef enum {
+    BENCH_RREQ,
+    BENCH_RREP,
+    BENCH_RERR,
+} bench_msg_type_t;
+
+/* a message as it is handed to the writer */
+struct bench_msg {
+    bench_msg_type_t type;
+    struct aodvv2_packet_data data;
+    struct unreachable_node unreachable[AODVV2_MAX_UNREACHABLE_NODES];
+    uint8_t num_unreachable;
+};
+
+struct bench_packet {
+    uint16_t len;
+    uint8_t buf[BENCH_MAX_PKT_SIZE];
+};
+
+struct bench_result {
+    uint32_t packets;
+    uint64_t bytes;
+    uint64_t elapsed;           /* us */
+    uint32_t allocs;
+    uint64_t alloc_bytes;
+};
+
+static struct bench_msg _msgs[BENCH_MAX_PACKETS];
+static struct bench_packet _packets[BENCH_MAX_PACKETS];
+static unsigned _num_packets;
+static bool _capture;           /* keep what the writer produces */
+static uint32_t _written_packets;
+static uint64_t _written_bytes;
+static uint32_t _rng;
+static struct netaddr _sender, _next_hop;
+
+static const char *_mix_names[] = {
+    [BENCH_MIX_REALISTIC] = "realistic",
+    [BENCH_MIX_ADVERSARIAL] = "adversarial",
+};
+
+#ifdef BENCH_COUNT_ALLOCS
+/* linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, see Makefile */
+static uint32_t _allocs;
+static uint64_t _alloc_bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+#endif
+
+static void _generate(bench_mix_t mix);
+static void _random_addr(struct netaddr *addr);
+static void _mutate(void);
+static void _write_all(struct bench_result *result);
+static void _read_all(struct bench_result *result);
+static void _write_packet(struct rfc5444_writer *wr, struct rfc5444_writer_target *iface,
+                          void *buffer, size_t length);
+static void _add_result(struct bench_result *total, struct bench_result *result);
+static void _print_result(const char *name, bench_mix_t mix, struct bench_result *result);
+static void _start_counting_allocs(void);
+static void _stop_counting_allocs(struct bench_result *result);
+static uint32_t _random(void);
+static uint64_t _now_us(void);
+
+void bench_rfc5444_run(bench_mix_t mix, uint32_t rounds, uint32_t seed)
+{
+    struct bench_result write_total, read_first, read_total, result;
+
+    memset(&write_total, 0, sizeof(write_total));
+    memset(&read_total, 0, sizeof(read_total));
+
+    _rng = seed ? seed : 1;
+    netaddr_from_string(&_sender, "2015:3:18:1111::1");
+    netaddr_from_string(&_next_hop, "ff02::6d");
+    aodv_packet_writer_init(_write_packet);
+    _generate(mix);
+
+    for (uint32_t i = 0; i < rounds; i++) {
+        _num_packets = 0;
+        _capture = true;
+        _write_all(&result);
+        _capture = false;
+        _add_result(&write_total, &result);
+
+        if (mix == BENCH_MIX_ADVERSARIAL) {
+            _mutate();
+        }
+
+        /* the packets are the same every round. Without forgetting what the
+         * last round taught the reader, they would all be dropped as
+         * redundant or stale from round 2 on. */
+        routingtable_init();
+        rreqtable_init();
+
+        _read_all(&result);
+        if (i == 0) {
+            /* cold caches and table memory touched for the first time */
+            read_first = result;
+        }
+        else {
+            _add_result(&read_total, &result);
+        }
+    }
+
+    _print_result("write", mix, &write_total);
+    if (rounds > 0) {
+        _print_result("read (round 1)", mix, &read_first);
+    }
+    if (rounds > 1) {
+        _print_result("read", mix, &read_total);
+    }
+}
+
+int bench_rfc5444_write_corpus(const char *dir, bench_mix_t mix, uint32_t seed)
+{
+    struct bench_result result;
+    char path[128];
+
+    _rng = seed ? seed : 1;
+    netaddr_from_string(&_sender, "2015:3:18:1111::1");
+    netaddr_from_string(&_next_hop, "ff02::6d");
+    aodv_packet_writer_init(_write_packet);
+    _generate(mix);
+
+    _num_packets = 0;
+    _capture = true;
+    _write_all(&result);
+    _capture = false;
+    if (mix == BENCH_MIX_ADVERSARIAL) {
+        _mutate();
+    }
+
+    for (unsigned i = 0; i < _num_packets; i++) {
+        snprintf(path, sizeof(path), "%s/%s_%03u.bin", dir, _mix_names[mix], i);
+        FILE *f = fopen(path, "wb");
+        if (!f) {
+            return -1;
+        }
+        fwrite(_packets[i].buf, 1, _packets[i].len, f);
+        fclose(f);
+    }
+    return _num_packets;
+}
+
+/* fill _msgs. Nothing is written yet so that generating the messages isn't
+ * measured. */
+static void _generate(bench_mix_t mix)
+{
+    timex_t now;
+    uint16_t seqnum = 1;
+
+    vtimer_now(&now);
+    memset(_msgs, 0, sizeof(_msgs));
+
+    for (unsigned i = 0; i < BENCH_MAX_PACKETS; i++) {
+        struct bench_msg *msg = &_msgs[i];
+        uint32_t pick = _random() % 10;
+
+        msg->type = (pick < 6) ? BENCH_RREQ : (pick < 9) ? BENCH_RREP : BENCH_RERR;
+        msg->data.hoplimit = 1 + _random() % AODVV2_MAX_HOPCOUNT;
+        msg->data.sender = _sender;
+        msg->data.metricType = AODVV2_DEFAULT_METRIC_TYPE;
+        _random_addr(&msg->data.origNode.addr);
+        _random_addr(&msg->data.targNode.addr);
+        msg->data.origNode.seqnum = seqnum++;
+        msg->data.origNode.metric = _random() % (AODVV2_MAX_HOPCOUNT - msg->data.hoplimit + 1);
+        msg->data.targNode.seqnum = (msg->type == BENCH_RREQ) ? 0 : seqnum++;
+        msg->data.targNode.metric = _random() % (AODVV2_MAX_HOPCOUNT - msg->data.hoplimit + 1);
+        msg->data.timestamp = now;
+        msg->num_unreachable = 1 + _random() % 3;
+
+        if (mix == BENCH_MIX_ADVERSARIAL) {
+            /* everything at the limits of what the fields can hold */
+            msg->data.hoplimit = (_random() % 2) ? 0 : 255;
+            msg->data.origNode.seqnum = (_random() % 2) ? 0 : 65535;
+            msg->data.targNode.seqnum = (_random() % 2) ? 0 : 65535;
+            msg->data.origNode.metric = 255;
+            msg->data.targNode.metric = 255;
+            if (msg->type == BENCH_RERR) {
+                msg->num_unreachable = AODVV2_MAX_UNREACHABLE_NODES;
+            }
+        }
+
+        for (unsigned j = 0; j < msg->num_unreachable; j++) {
+            _random_addr(&msg->unreachable[j].addr);
+            msg->unreachable[j].seqnum = seqnum++;
+        }
+    }
+}
+
+/* an address in the /64 the test nodes use */
+static void _random_addr(struct netaddr *addr)
+{
+    netaddr_from_string(addr, "2015:3:18:1111::");
+    for (int i = 8; i < 16; i++) {
+        addr->_addr[i] = _random() & 0xff;
+    }
+}
+
+/* damage the packets the way a broken or malicious neighbor would */
+static void _mutate(void)
+{
+    for (unsigned i = 0; i < _num_packets; i++) {
+        struct bench_packet *pkt = &_packets[i];
+        unsigned n;
+
+        switch (_random() % 5) {
+            case 0:
+                /* truncated */
+                pkt->len = _random() % (pkt->len + 1);
+                break;
+            case 1:
+                /* a few flipped bytes */
+                n = 1 + _random() % 4;
+                for (unsigned j = 0; (j < n) && pkt->len; j++) {
+                    pkt->buf[_random() % pkt->len] ^= 1 + _random() % 255;
+                }
+                break;
+            case 2:
+                /* trailing garbage */
+                while (pkt->len < BENCH_MAX_PKT_SIZE) {
+                    pkt->buf[pkt->len++] = _random() & 0xff;
+                }
+                break;
+            case 3:
+                /* random data of the same length */
+                for (unsigned j = 0; j < pkt->len; j++) {
+                    pkt->buf[j] = _random() & 0xff;
+                }
+                break;
+            default:
+                /* left intact */
+                break;
+        }
+    }
+}
+
+static void _write_all(struct bench_result *result)
+{
+    _written_packets = 0;
+    _written_bytes = 0;
+
+    _start_counting_allocs();
+    uint64_t start = _now_us();
+
+    for (unsigned i = 0; i < BENCH_MAX_PACKETS; i++) {
+        struct bench_msg *msg = &_msgs[i];
+
+        switch (msg->type) {
+            case BENCH_RREQ:
+                aodv_packet_writer_send_rreq(&msg->data, &_next_hop);
+                break;
+            case BENCH_RREP:
+                aodv_packet_writer_send_rrep(&msg->data, &_sender);
+                break;
+            case BENCH_RERR:
+                aodv_packet_writer_send_rerr(msg->unreachable, msg->num_unreachable,
+                                             msg->data.hoplimit, &_next_hop);
+                break;
+        }
+    }
+
+    result->elapsed = _now_us() - start;
+    _stop_counting_allocs(result);
+    result->packets = _written_packets;
+    result->bytes = _written_bytes;
+}
+
+static void _read_all(struct bench_result *result)
+{
+    result->packets = 0;
+    result->bytes = 0;
+
+    _start_counting_allocs();
+    uint64_t start = _now_us();
+
+    for (unsigned i = 0; i < _num_packets; i++) {
+        /* the reader may answer or forward; those packets aren't kept */
+        aodv_packet_reader_handle_packet(_packets[i].buf, _packets[i].len, &_sender);
+        result->packets++;
+        result->bytes += _packets[i].len;
+    }
+
+    result->elapsed = _now_us() - start;
+    _stop_counting_allocs(result);
+}
+
+static void _write_packet(struct rfc5444_writer *wr, struct rfc5444_writer_target *iface,
+                          void *buffer, size_t length)
+{
+    (void) wr;
+    (void) iface;
+
+    _written_packets++;
+    _written_bytes += length;
+
+    if (_capture && (_num_packets < BENCH_MAX_PACKETS) && (length <= BENCH_MAX_PKT_SIZE)) {
+        memcpy(_packets[_num_packets].buf, buffer, length);
+        _packets[_num_packets].len = length;
+        _num_packets++;
+    }
+}
+
+static void _add_result(struct bench_result *total, struct bench_result *result)
+{
+    total->packets += result->packets;
+    total->bytes += result->bytes;
+    total->elapsed += result->elapsed;
+    total->allocs += result->allocs;
+    total->alloc_bytes += result->alloc_bytes;
+}
+
+static void _print_result(const char *name, bench_mix_t mix, struct bench_result *result)
+{
+    uint64_t elapsed = result->elapsed ? result->elapsed : 1;
+
+    /* every packet carries one message */
+    printf("[bench]  %s %s: %" PRIu32 " msgs, %" PRIu32 " bytes in %" PRIu32 " us: "
+           "%" PRIu32 " msgs/s, %" PRIu32 " bytes/s",
+           name, _mix_names[mix], result->packets, (uint32_t) result->bytes,
+           (uint32_t) result->elapsed, (uint32_t)(result->packets * 1000000ULL / elapsed),
+           (uint32_t)(result->bytes * 1000000ULL / elapsed));
+#ifdef BENCH_COUNT_ALLOCS
+    printf(", %" PRIu32 " allocs, %" PRIu32 " bytes allocated",
+           result->allocs, (uint32_t) result->alloc_bytes);
+#endif
+    printf("\n");
+}
+
+static void _start_counting_allocs(void)
+{
+#ifdef BENCH_COUNT_ALLOCS
+    _allocs = 0;
+    _alloc_bytes = 0;
+#endif
+}
+
+static void _stop_counting_allocs(struct bench_result *result)
+{
+#ifdef BENCH_COUNT_ALLOCS
+    result->allocs = _allocs;
+    result->alloc_bytes = _alloc_bytes;
+#else
+    result->allocs = 0;
+    result->alloc_bytes = 0;
+#endif
+}
+
+/* xorshift32, the benchmark must not depend on the platform's rand() */
+static uint32_t _random(void)
+{
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return _rng;
+}
+
+static uint64_t _now_us(void)
+{
+    timex_t now;
+    vtimer_now(&now);
+    return timex_uint64(now);
+}
+
+#ifdef BENCH_COUNT_ALLOCS
+void *__wrap_malloc(size_t size)
+{
+    _allocs++;
+    _alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    _allocs++;
+    _alloc_bytes += nmemb * size;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    _allocs++;
+    _alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     tests
+ * @{
+ *
+ * @file        bench_rfc5444.h
+ * @brief       throughput of the AODVv2 RFC 5444 writer and reader
+ *
+ * The benchmark writes a mix of RREQs, RREPs and RERRs with the aodvv2
+ * writer, keeps the packets it produces and feeds them, plus mutated copies
+ * of them, to the reader. For both directions it prints messages/s, bytes/s
+ * and, on native, how many allocations were made and how many bytes they
+ * requested. The routing and RREQ tables are cleared before every reader
+ * run, so that no round only measures how fast redundant messages are
+ * dropped. The first reader run is reported on its own.
+ *
+ * Message mixes:
+ * realistic    RREQ:RREP:RERR 6:3:1, addresses from one /64, increasing
+ *              SeqNums, metrics below the hop limit, RERRs with 1-3 nodes
+ * adversarial  RERRs with AODVV2_MAX_UNREACHABLE_NODES nodes, extreme
+ *              SeqNums and metrics, and the realistic packets truncated,
+ *              with flipped bytes, with random bytes appended or replaced
+ *              by random data
+ *
+ * The packets can also be written to a directory, one file per packet, as
+ * seed corpus for a coverage guided fuzzer (AFL, libFuzzer) that feeds files
+ * to aodv_packet_reader_handle_packet(). The corpus only depends on the mix
+ * and the seed.
+ */
+
+#ifndef AODVV2_BENCH_RFC5444_H_
+#define AODVV2_BENCH_RFC5444_H_
+
+#include <stdint.h>
+
+/* packets kept from the writer run, each is read once per reader run */
+#define BENCH_MAX_PACKETS       (256)
+#define BENCH_MAX_PKT_SIZE      (512)
+
+typedef enum {
+    BENCH_MIX_REALISTIC,
+    BENCH_MIX_ADVERSARIAL,
+} bench_mix_t;
+
+/**
+ * @brief   Run the writer and the reader benchmark and print the results.
+ *          Clears the routing and RREQ tables.
+ *
+ * @param[in] mix           message mix to generate
+ * @param[in] rounds        how often the writer and reader runs are repeated
+ * @param[in] seed          seed of the message generator, the same seed
+ *                          always gives the same messages
+ */
+void bench_rfc5444_run(bench_mix_t mix, uint32_t rounds, uint32_t seed);
+
+/**
+ * @brief   Write the packets of a mix to dir as <mix>_<n>.bin.
+ *
+ * @param[in] dir           existing directory
+ * @param[in] mix           message mix to generate
+ * @param[in] seed          seed of the message generator
+ *
+ * @return  number of files written, -1 if dir couldn't be written to
+ */
+int bench_rfc5444_write_corpus(const char *dir, bench_mix_t mix, uint32_t seed);
+
+#endif /* AODVV2_BENCH_RFC5444_H_ */
+/** @} */
@@ -0,0 +1,2 @@
+/* the route feed of the demo application, built in here for test_routefeed.c */
+#include "../aodvv2_demo/routefeed.c"
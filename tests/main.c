@@ -31,6 +31,16 @@
 #include "aodv_writer_tests.h"
 #include "aodv_tests.h"
 
+void test_routefeed_main(void);
+
+#if defined(AODVV2_BENCH) || defined(AODVV2_CORPUS)
+#include "bench_rfc5444.h"
+
+#define BENCH_ROUNDS           (100)    /**< writer/reader runs per mix */
+#define BENCH_SEED             (1)      /**< seed of the message generator */
+#define BENCH_CORPUS_DIR       "corpus" /**< where the fuzzer seeds go, must exist */
+#endif
+
 #define AODVV2_CHANNEL         (26)     /**< The used channel */
 #define AODVV2_PAN             (0x03e9) /**< The used PAN ID */
 #define AODVV2_IFACE           (0)      /**< The used Trasmssion device */
@@ -83,6 +93,23 @@ int main(void)
     aodv_init();
 
     write_packets_to_files();
+    test_routefeed_main();
+
+#ifdef AODVV2_CORPUS
+    if ((bench_rfc5444_write_corpus(BENCH_CORPUS_DIR, BENCH_MIX_REALISTIC, BENCH_SEED) < 0)
+        || (bench_rfc5444_write_corpus(BENCH_CORPUS_DIR, BENCH_MIX_ADVERSARIAL, BENCH_SEED) < 0)) {
+        printf("could not write the corpus to %s/\n", BENCH_CORPUS_DIR);
+    }
+#endif
+
+#ifdef AODVV2_BENCH
+    bench_rfc5444_run(BENCH_MIX_REALISTIC, BENCH_ROUNDS, BENCH_SEED);
+    bench_rfc5444_run(BENCH_MIX_ADVERSARIAL, BENCH_ROUNDS, BENCH_SEED);
+    /* native keeps running after main() returns, so tell scripts that
+     * read the results (vnet_tester/regression_gate.py) when to stop */
+    puts("[bench] done");
+    fflush(stdout);
+#endif
 
     sleep(5);
 
@@ -0,0 +1,83 @@
+#include <stdio.h>
+
+#include "constants.h"
+#include "routing.h"
+#include "utils.h"
+#include "cunit/cunit.h"
+
+#include "common/netaddr.h"
+
+#include "routefeed.h"
+
+static struct netaddr_str nbuf;
+
+static void _add_route(struct netaddr *addr, struct netaddr *next_hop)
+{
+    timex_t now, validity_t;
+
+    vtimer_now(&now);
+    validity_t = timex_set(AODVV2_ACTIVE_INTERVAL + AODVV2_MAX_IDLETIME, 0);
+
+    struct aodvv2_routing_entry_t entry = {
+        .addr = *addr,
+        .seqnum = 1,
+        .nextHopAddr = *next_hop,
+        .lastUsed = now,
+        .expirationTime = timex_add(now, validity_t),
+        .metricType = AODVV2_DEFAULT_METRIC_TYPE,
+        .metric = 2,
+        .state = ROUTE_STATE_ACTIVE
+    };
+    routingtable_add_entry(&entry);
+}
+
+/*
+ * The feed only covers routes that traffic was routed along: aodvv2 can't be
+ * asked for all entries of its routing table, so a route installed by a RREQ
+ * or RREP isn't reported until forwarding_get_next_hop() is asked about its
+ * destination. From then on, every read picks up its changes.
+ */
+void test_routefeed_used_routes_only(void)
+{
+    struct routefeed_event event;
+    struct netaddr addr, next_hop;
+
+    netaddr_from_string(&addr, "::23");
+    netaddr_from_string(&next_hop, "::42");
+
+    START_TEST();
+
+    routingtable_init();
+    routefeed_init();
+
+    /* what aodvv2 does with a RREP: the route is there, but not reported */
+    _add_route(&addr, &next_hop);
+    routefeed_update_all();
+    CHECK_TRUE(routefeed_next_id() == 0, "route to %s reported before it was used\n",
+               netaddr_to_string(&nbuf, &addr));
+
+    /* what forwarding_get_next_hop() does when a packet is routed */
+    routefeed_update(&addr);
+    CHECK_TRUE(routefeed_get(0, &event) && (event.type == ROUTEFEED_ADD)
+               && (netaddr_cmp(&event.addr, &addr) == 0),
+               "route to %s not reported once it was used\n", netaddr_to_string(&nbuf, &addr));
+
+    /* observed from now on, even without traffic */
+    routingtable_get_entry(&addr, AODVV2_DEFAULT_METRIC_TYPE)->metric = 3;
+    routefeed_update_all();
+    CHECK_TRUE(routefeed_get(1, &event) && (event.type == ROUTEFEED_UPDATE) && (event.metric == 3),
+               "change of the route to %s not reported\n", netaddr_to_string(&nbuf, &addr));
+
+    routingtable_delete_entry(&addr, AODVV2_DEFAULT_METRIC_TYPE);
+
+    END_TEST();
+}
+
+void test_routefeed_main(void)
+{
+    BEGIN_TESTING(NULL);
+
+    test_routefeed_used_routes_only();
+
+    FINISH_TESTING();
+}
@@ -1,5 +1,209 @@
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "socket_base/socket.h"
 
+/**
+ * The virtual network simulates a mesh of nodes inside a single process.
+ * Nodes are numbered 0..n-1; node i has the address fe80::ff:fe00:<i+1>.
+ * Time is simulated and only advances in virtualnetwork_run().
+ *
+ * Packets are sent on behalf of the "current node": the node whose receive
+ * handler or routing provider is being called, or the one chosen with
+ * virtualnetwork_set_current_node() when traffic is injected from outside.
+ *
+ * Every node transmits one frame at a time. Frames waiting for the channel
+ * are kept in two queues: AODVv2 control messages (sent to the MANET port)
+ * are always transmitted before data, and data is dropped once its queue is
+ * full, so that a data burst can't delay route discovery.
+ *
+ * A node can have several interfaces (radios). Every link belongs to one
+ * interface, and each interface transmits independently from its own
+ * queues. Multicast packets go out on every interface of the sender; unicast
+ * packets leave on the interface that connects to the next hop.
+ *
+ * How frames travel over the air is decided by the channel model. The
+ * default is a perfect channel: every frame takes VIRTUALNETWORK_FRAME_TIME
+ * and arrives. virtualnetwork_channel_802154 instead charges airtime at
+ * 250 kbit/s, loses frames that overlap at a receiver (including frames the
+ * receiver can't hear itself, i.e. hidden terminals), and makes senders back
+ * off with CSMA-CA while the channel is busy. Independent of the model, every
+ * link can lose a share of its frames and delay them.
+ *
+ * Large networks can be simulated by several threads, each of which takes
+ * care of a block of nodes (applications link with -pthread, see
+ * tests/Makefile). A thread may run ahead of the others by as much as the
+ * smallest latency of the links between their blocks, so links need a
+ * latency for this to help. Parallel runs give the same results as
+ * sequential ones, as long as the receive handler and the routing provider
+ * only touch the state of the node they are called for (checked by
+ * tests/test_threads.c).
+ */
+
+#define VIRTUALNETWORK_MAX_PKT_SIZE     (256)       /**< payload bytes per packet */
+#define VIRTUALNETWORK_MANET_PORT       (269)       /**< packets to this port are control traffic */
+#define VIRTUALNETWORK_CTRL_QUEUE_LEN   (16)        /**< frames per node */
+#define VIRTUALNETWORK_DATA_QUEUE_LEN   (8)         /**< frames per node */
+#define VIRTUALNETWORK_INBOX_LEN        (16)        /**< received packets per node */
+#define VIRTUALNETWORK_FRAME_TIME       (1000)      /**< microseconds per frame */
+#define VIRTUALNETWORK_MAX_IFACES       (2)         /**< interfaces per node */
+
+#define VIRTUALNETWORK_BITRATE          (250000)    /**< bits per second of an 802.15.4 radio */
+#define VIRTUALNETWORK_FRAME_OVERHEAD   (31)        /**< PHY, MAC and compressed IPv6/UDP header bytes */
+#define VIRTUALNETWORK_UNIT_BACKOFF     (320)       /**< microseconds, aUnitBackoffPeriod */
+#define VIRTUALNETWORK_MIN_BE           (3)         /**< macMinBE */
+#define VIRTUALNETWORK_MAX_BE           (5)         /**< macMaxBE */
+#define VIRTUALNETWORK_MAX_BACKOFFS     (4)         /**< macMaxCSMABackoffs */
+
+/**
+ * @brief   traffic classes of the transmit queues
+ */
+typedef enum {
+    VIRTUALNETWORK_CLASS_CTRL = 0,
+    VIRTUALNETWORK_CLASS_DATA,
+    VIRTUALNETWORK_CLASS_NUMOF
+} virtualnetwork_class_t;
+
+/**
+ * @brief   channel model
+ */
+typedef struct {
+    uint32_t bitrate;       /**< bits per second, 0: every frame takes VIRTUALNETWORK_FRAME_TIME */
+    uint16_t overhead;      /**< header bytes sent with every frame */
+    bool collisions;        /**< frames that overlap at a receiver are lost */
+    bool csma;              /**< sense the channel and back off before sending */
+} virtualnetwork_channel_t;
+
+extern const virtualnetwork_channel_t virtualnetwork_channel_perfect;
+extern const virtualnetwork_channel_t virtualnetwork_channel_802154;
+
+/**
+ * @brief   called when a packet for node has been put into its inbox.
+ *          The node is the current node while the handler runs.
+ */
+typedef void (*virtualnetwork_receive_handler_t)(uint16_t node);
+
+/**
+ * @brief   Set up a network of num_nodes nodes without any links.
+ *
+ * @return  0 on success, -1 if there isn't enough memory
+ */
+int virtualnetwork_init(uint16_t num_nodes);
+
+/**
+ * @brief   Free everything allocated by virtualnetwork_init().
+ */
+void virtualnetwork_destroy(void);
+
+/**
+ * @brief   Connect nodes a and b (in both directions) on interface 0.
+ *
+ * @return  0 on success, -1 on error
+ */
+int virtualnetwork_add_link(uint16_t a, uint16_t b);
+
+/**
+ * @brief   Connect nodes a and b (in both directions) on interface iface.
+ *          If a and b are linked on several interfaces, unicast traffic
+ *          between them uses the one with the fewest frames waiting.
+ *
+ * @return  0 on success, -1 on error
+ */
+int virtualnetwork_add_iface_link(uint16_t a, uint16_t b, uint8_t iface);
+
+/**
+ * @brief   Set loss and latency of the link from node from to node to.
+ *          Links start out without loss and latency.
+ *
+ * @param[in] loss          per mille of the frames that are lost
+ * @param[in] latency       delay of every frame in microseconds
+ *
+ * @return  0 on success, -1 if there is no such link
+ */
+int virtualnetwork_set_link_quality(uint16_t from, uint16_t to, uint8_t iface,
+                                    uint16_t loss, uint32_t latency);
+
+/**
+ * @brief   Choose the channel model.
+ */
+void virtualnetwork_set_channel(const virtualnetwork_channel_t *channel);
+
+/**
+ * @brief   Seed the random sequences of all nodes. Runs with the same seed,
+ *          topology and traffic have the same outcome.
+ */
+void virtualnetwork_set_seed(uint32_t seed);
+
+/**
+ * @brief   Set the number of threads virtualnetwork_run() uses.
+ *          Can be changed at any time between runs.
+ *
+ * @return  0 on success, -1 on error
+ */
+int virtualnetwork_set_threads(unsigned threads);
+
+/**
+ * @brief   Set up a network from a file written by topology_gen.py: a line
+ *          "# nodes <n>", followed by one line "<a> <b> [iface]" per link.
+ *          Other lines starting with # are ignored.
+ *
+ * @return  number of nodes, -1 if the file can't be read or is malformed
+ */
+int virtualnetwork_load_topology(const char *path);
+
+/**
+ * @brief   Get the address of a node.
+ */
+void virtualnetwork_get_addr(uint16_t node, ipv6_addr_t *addr);
+
+/**
+ * @brief   Get the node that owns addr.
+ *
+ * @return  node id, -1 if no node has this address
+ */
+int virtualnetwork_get_node(ipv6_addr_t *addr);
+
+/**
+ * @brief   Get the neighbors of a node (on any interface).
+ *
+ * @param[out] neighbors    filled with up to max node ids
+ *
+ * @return  number of neighbors stored, -1 if there is no such node
+ */
+int virtualnetwork_get_neighbors(uint16_t node, uint16_t *neighbors, uint16_t max);
+
+/**
+ * @brief   Choose the node that virtualnetwork_sendto() sends from.
+ */
+void virtualnetwork_set_current_node(uint16_t node);
+
+/**
+ * @brief   Get the node on whose behalf the network is currently acting.
+ */
+uint16_t virtualnetwork_get_current_node(void);
+
+/**
+ * @brief   Set the function that is called for every packet that is received.
+ */
+void virtualnetwork_set_receive_handler(virtualnetwork_receive_handler_t handler);
+
+/**
+ * @brief   Simulated time in microseconds.
+ */
+uint64_t virtualnetwork_now(void);
+
+/**
+ * @brief   Process all events of the next duration microseconds.
+ *
+ * @return  number of events processed
+ */
+uint32_t virtualnetwork_run(uint64_t duration);
+
+/**
+ * @brief   Print queue statistics of all nodes, summed up per traffic class.
+ */
+void virtualnetwork_print_stats(void);
+
 /**
  * Substitute for socket_base_sendto().
  * Some of the fields are ignored, but have been left in for easier portability.
@@ -16,6 +220,20 @@
 int virtualnetwork_sendto(int s, const void *buf, uint32_t len, int flags,
                               sockaddr6_t *to, socklen_t tolen);
 
+/**
+ * @brief   Hand a packet to node at the given simulated time, as if node had
+ *          received it, regardless of its destination.
+ *
+ * @param[in] time          microseconds, the current time if it has passed
+ * @param[in] src           IPv6 source address
+ * @param[in] dst           IPv6 destination address
+ * @param[in] port          UDP destination port
+ *
+ * @return  0 on success, -1 on error
+ */
+int virtualnetwork_inject(uint16_t node, uint64_t time, ipv6_addr_t *src, ipv6_addr_t *dst,
+                          uint16_t port, const void *buf, uint32_t len);
+
 /**
  * @brief   Substitute for ipv6_iface_set_routing_provider().
  *
@@ -26,6 +244,7 @@ void virtualnetwork_set_routing_provider(ipv6_addr_t *(*next_hop)(ipv6_addr_t *d
 /**
  * Substitute for socket_base_recvfrom().
  * Some of the fields are ignored, but have been left in for easier portability.
+ * Never blocks: packets are taken from the inbox of the current node.
  *
  * @param[in] s         The ID of the socket to receive from.
  * @param[in] buf       Buffer to store received data in.
@@ -35,7 +254,43 @@ void virtualnetwork_set_routing_provider(ipv6_addr_t *(*next_hop)(ipv6_addr_t *d
  * @param[in] from      IPv6 Address of the data's sender.
  * @param[in] fromlen   Length of address in *from* in byte (always 16).
  *
- * @return Number of received bytes, -1 on error.
+ * @return Number of received bytes, -1 on error or if the inbox is empty.
  */
-int32_t socket_base_recvfrom(int s, void *buf, uint32_t len, int flags,
+int32_t virtualnetwork_recvfrom(int s, void *buf, uint32_t len, int flags,
                                 sockaddr6_t *from, socklen_t *fromlen);
+
+/**
+ * @brief   what virtualnetwork_replay() found in a capture
+ */
+struct virtualnetwork_replay_stats {
+    uint32_t packets;           /**< records in the capture */
+    uint32_t injected;          /**< packets handed to nodes */
+    uint32_t rreq;              /**< RREQs in the injected packets */
+    uint32_t rrep;              /**< RREPs in the injected packets */
+    uint32_t rerr;              /**< RERRs in the injected packets */
+    uint32_t data;              /**< injected packets that weren't sent to the MANET port */
+    uint32_t skipped;           /**< malformed, not UDP over IPv6, too large or no node to receive them */
+};
+
+/**
+ * @brief   Replay a pcap capture (Ethernet, raw IPv6 or Linux cooked) into
+ *          the network. Frames RIOT native nodes sent over their tap
+ *          interfaces (802.15.4 and 6LoWPAN inside Ethernet, as in the
+ *          captures in vnet_tester/dumps) are decompressed first; fragmented
+ *          packets are skipped. Every UDP packet is injected into a node with
+ *          virtualnetwork_inject(). Packets to the MANET port are decoded as
+ *          RFC 5444 packets to count the AODVv2 messages they carry.
+ *
+ * @param[in]  path         capture file
+ * @param[in]  node         node that receives all packets, or -1 to hand every
+ *                          packet to the node that owns its destination address
+ *                          (multicast packets go to the neighbors of the node
+ *                          that owns the source address)
+ * @param[in]  timed        keep the gaps between the packets of the capture,
+ *                          otherwise inject them all at the current time
+ * @param[out] stats        what was found in the capture, may be NULL
+ *
+ * @return  number of injected packets, -1 if the file isn't a pcap capture
+ */
+int virtualnetwork_replay(const char *path, int node, bool timed,
+                          struct virtualnetwork_replay_stats *stats);
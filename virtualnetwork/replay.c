@@ -0,0 +1,624 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "virtualnetwork.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#define PCAP_MAGIC              (0xa1b2c3d4)
+#define PCAP_MAGIC_NSEC         (0xa1b23c4d)
+#define PCAP_MAX_RECORD         (65535)
+
+/* initial size of the receiver list, doubled for nodes with more neighbors */
+#define REPLAY_RECEIVERS        (64)
+
+#define LINKTYPE_ETHERNET       (1)
+#define LINKTYPE_RAW            (101)
+#define LINKTYPE_IPV6           (229)
+#define LINKTYPE_LINUX_SLL      (113)
+
+#define ETHERTYPE_IPV6          (0x86dd)
+/* RIOT native tap frames: <length> <dst> <src> followed by an 802.15.4 frame */
+#define ETHERTYPE_RIOT_NATIVE   (0x1234)
+#define RIOT_NATIVE_HEADER_LEN  (6)
+#define IEEE802154_FCS_LEN      (2)
+
+#define LOWPAN_IPV6_DISPATCH    (0x41)
+#define LOWPAN_IPHC_DISPATCH    (0x60)  /* 011x xxxx */
+#define LOWPAN_NHC_UDP          (0xf0)  /* 1111 0xxx */
+
+#define IPV6_HEADER_LEN         (40)
+#define UDP_HEADER_LEN          (8)
+
+#define IPPROTO_HOPOPTS         (0)
+#define IPPROTO_ROUTING         (43)
+#define IPPROTO_DSTOPTS         (60)
+#define IPPROTO_UDP_NUM         (17)
+
+/* from the aodvv2 module */
+#define RFC5444_MSGTYPE_RREQ    (10)
+#define RFC5444_MSGTYPE_RREP    (11)
+#define RFC5444_MSGTYPE_RERR    (12)
+
+/* RFC 5444 packet header flags */
+#define RFC5444_PKT_HAS_SEQNUM  (0x08)
+#define RFC5444_PKT_HAS_TLV     (0x04)
+
+struct replay_capture {
+    FILE *f;
+    bool swapped;               /* written on a machine of the other byte order */
+    bool nsec;                  /* timestamps in nanoseconds */
+    uint32_t linktype;
+};
+
+static int _open_capture(struct replay_capture *cap, const char *path);
+static int _read_record(struct replay_capture *cap, uint8_t *buf, uint32_t *len, uint64_t *ts);
+static int _find_ipv6(struct replay_capture *cap, uint8_t *buf, uint32_t len,
+                      uint8_t **ip, uint32_t *ip_len);
+static int _parse_802154(uint8_t *buf, uint32_t len, uint8_t *ip, uint32_t *ip_len);
+static int _decompress_iphc(uint8_t *buf, uint32_t len, uint8_t *src_mac, uint8_t src_mac_len,
+                            uint8_t *dst_mac, uint8_t dst_mac_len, uint8_t *ip, uint32_t *ip_len);
+static int _decompress_addr(uint8_t *addr, uint8_t mode, uint8_t *buf, uint32_t len,
+                            uint8_t *mac, uint8_t mac_len);
+static int _decompress_multicast(uint8_t *addr, uint8_t mode, uint8_t *buf, uint32_t len);
+static void _count_messages(uint8_t *buf, uint32_t len, struct virtualnetwork_replay_stats *stats);
+static int _get_neighbors(uint16_t node, uint16_t **neighbors, uint16_t *max);
+static uint32_t _get32(struct replay_capture *cap, uint8_t *p);
+static uint16_t _get_be16(uint8_t *p);
+static void _set_be16(uint8_t *p, uint16_t value);
+
+int virtualnetwork_replay(const char *path, int node, bool timed,
+                          struct virtualnetwork_replay_stats *stats)
+{
+    struct replay_capture cap;
+    struct virtualnetwork_replay_stats counts;
+    uint64_t start = virtualnetwork_now();
+    uint64_t first_ts = 0, ts;
+    uint32_t len;
+    uint16_t max_receivers = REPLAY_RECEIVERS;
+
+    memset(&counts, 0, sizeof(counts));
+    if (_open_capture(&cap, path) < 0) {
+        return -1;
+    }
+
+    /* records, and the IPv6 packets decompressed from 6LoWPAN records */
+    uint8_t *buf = malloc(2 * PCAP_MAX_RECORD);
+    uint16_t *receivers = malloc(max_receivers * sizeof(*receivers));
+    if (!buf || !receivers) {
+        free(buf);
+        free(receivers);
+        fclose(cap.f);
+        return -1;
+    }
+
+    while (_read_record(&cap, buf, &len, &ts) == 0) {
+        uint8_t *ip;
+
+        if (counts.packets++ == 0) {
+            first_ts = ts;
+        }
+
+        if (_find_ipv6(&cap, buf, len, &ip, &len) < 0) {
+            counts.skipped++;
+            continue;
+        }
+
+        /* skip the extension headers RIOT may add, until we get to UDP */
+        uint8_t next_header = ip[6];
+        uint32_t pos = IPV6_HEADER_LEN;
+
+        while (((next_header == IPPROTO_HOPOPTS) || (next_header == IPPROTO_ROUTING)
+                || (next_header == IPPROTO_DSTOPTS)) && (pos + 2 <= len)) {
+            next_header = ip[pos];
+            pos += (ip[pos + 1] + 1) * 8;
+        }
+        if ((next_header != IPPROTO_UDP_NUM) || (pos + UDP_HEADER_LEN > len)) {
+            counts.skipped++;
+            continue;
+        }
+
+        uint16_t port = _get_be16(ip + pos + 2);
+        uint16_t udp_len = _get_be16(ip + pos + 4);
+        uint8_t *payload = ip + pos + UDP_HEADER_LEN;
+        if ((udp_len < UDP_HEADER_LEN) || (pos + udp_len > len)) {
+            counts.skipped++;
+            continue;
+        }
+        uint32_t payload_len = udp_len - UDP_HEADER_LEN;
+
+        ipv6_addr_t src, dst;
+        memcpy(&src, ip + 8, sizeof(src));
+        memcpy(&dst, ip + 24, sizeof(dst));
+
+        /* pick the nodes that receive the packet */
+        int num_receivers = 0;
+
+        if (node >= 0) {
+            receivers[num_receivers++] = node;
+        }
+        else if (dst.uint8[0] == 0xff) {
+            int sender = virtualnetwork_get_node(&src);
+            if (sender >= 0) {
+                num_receivers = _get_neighbors(sender, &receivers, &max_receivers);
+            }
+        }
+        else {
+            int receiver = virtualnetwork_get_node(&dst);
+            if (receiver >= 0) {
+                receivers[num_receivers++] = receiver;
+            }
+        }
+
+        /* records aren't always in order: inject the early ones right away */
+        uint64_t time = (timed && (ts > first_ts)) ? start + (ts - first_ts) : start;
+        int injected = 0;
+        for (int i = 0; i < num_receivers; i++) {
+            if (virtualnetwork_inject(receivers[i], time, &src, &dst, port, payload, payload_len) == 0) {
+                injected++;
+            }
+        }
+        if (injected == 0) {
+            counts.skipped++;
+            continue;
+        }
+
+        counts.injected++;
+        if (port == VIRTUALNETWORK_MANET_PORT) {
+            _count_messages(payload, payload_len, &counts);
+        }
+        else {
+            counts.data++;
+        }
+    }
+
+    free(receivers);
+    free(buf);
+    fclose(cap.f);
+
+    DEBUG("[virtualnetwork] replayed %" PRIu32 " of %" PRIu32 " packets from %s\n",
+          counts.injected, counts.packets, path);
+    if (stats) {
+        *stats = counts;
+    }
+    return counts.injected;
+}
+
+static int _open_capture(struct replay_capture *cap, const char *path)
+{
+    uint8_t header[24];
+
+    cap->f = fopen(path, "rb");
+    if (!cap->f) {
+        return -1;
+    }
+    if (fread(header, sizeof(header), 1, cap->f) != 1) {
+        fclose(cap->f);
+        return -1;
+    }
+
+    uint32_t magic = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t) header[3] << 24);
+    uint32_t swapped = header[3] | (header[2] << 8) | (header[1] << 16) | ((uint32_t) header[0] << 24);
+
+    if ((magic == PCAP_MAGIC) || (magic == PCAP_MAGIC_NSEC)) {
+        cap->swapped = false;
+        cap->nsec = (magic == PCAP_MAGIC_NSEC);
+    }
+    else if ((swapped == PCAP_MAGIC) || (swapped == PCAP_MAGIC_NSEC)) {
+        cap->swapped = true;
+        cap->nsec = (swapped == PCAP_MAGIC_NSEC);
+    }
+    else {
+        fclose(cap->f);
+        return -1;
+    }
+
+    cap->linktype = _get32(cap, header + 20);
+    return 0;
+}
+
+/* read the next record into buf. ts is in microseconds. */
+static int _read_record(struct replay_capture *cap, uint8_t *buf, uint32_t *len, uint64_t *ts)
+{
+    uint8_t header[16];
+
+    if (fread(header, sizeof(header), 1, cap->f) != 1) {
+        return -1;
+    }
+
+    uint32_t seconds = _get32(cap, header);
+    uint32_t fraction = _get32(cap, header + 4);
+    *len = _get32(cap, header + 8);
+
+    if ((*len > PCAP_MAX_RECORD) || (fread(buf, 1, *len, cap->f) != *len)) {
+        return -1;
+    }
+    *ts = (uint64_t) seconds * 1000000 + (cap->nsec ? fraction / 1000 : fraction);
+    return 0;
+}
+
+/* find the IPv6 packet in a record, decompressing it if it was sent by a RIOT
+ * native node. ip points into buf or behind the record. */
+static int _find_ipv6(struct replay_capture *cap, uint8_t *buf, uint32_t len,
+                      uint8_t **ip, uint32_t *ip_len)
+{
+    uint32_t offset;
+    uint16_t ethertype;
+
+    switch (cap->linktype) {
+        case LINKTYPE_ETHERNET:
+            if (len < 14) {
+                return -1;
+            }
+            ethertype = _get_be16(buf + 12);
+            offset = 14;
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (len < 16) {
+                return -1;
+            }
+            ethertype = _get_be16(buf + 14);
+            offset = 16;
+            break;
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV6:
+            ethertype = ETHERTYPE_IPV6;
+            offset = 0;
+            break;
+        default:
+            return -1;
+    }
+
+    if (ethertype == ETHERTYPE_RIOT_NATIVE) {
+        if (len < offset + RIOT_NATIVE_HEADER_LEN) {
+            return -1;
+        }
+        uint16_t frame_len = _get_be16(buf + offset);
+        offset += RIOT_NATIVE_HEADER_LEN;
+        if (offset + frame_len > len) {
+            return -1;
+        }
+        *ip = buf + PCAP_MAX_RECORD;
+        return _parse_802154(buf + offset, frame_len, *ip, ip_len);
+    }
+
+    if ((ethertype != ETHERTYPE_IPV6) || (len < offset + IPV6_HEADER_LEN)
+        || ((buf[offset] >> 4) != 6)) {
+        return -1;
+    }
+    *ip = buf + offset;
+    *ip_len = len - offset;
+    return 0;
+}
+
+/* strip the 802.15.4 header and undo the 6LoWPAN compression */
+static int _parse_802154(uint8_t *buf, uint32_t len, uint8_t *ip, uint32_t *ip_len)
+{
+    uint8_t addr_len[] = { 0, 0, 2, 8 };
+    uint8_t *dst_mac, *src_mac;
+
+    if (len < 3 + IEEE802154_FCS_LEN) {
+        return -1;
+    }
+    len -= IEEE802154_FCS_LEN;
+
+    /* the frame control field is little endian */
+    uint16_t fcf = buf[0] | (buf[1] << 8);
+    uint8_t dst_mode = (fcf >> 10) & 0x3;
+    uint8_t src_mode = (fcf >> 14) & 0x3;
+    bool pan_id_compression = fcf & (1 << 6);
+    uint32_t pos = 3;
+
+    if (fcf & (1 << 3)) {
+        /* no way to decrypt it */
+        return -1;
+    }
+    if (dst_mode) {
+        pos += 2;
+    }
+    dst_mac = buf + pos;
+    pos += addr_len[dst_mode];
+    if (src_mode && !pan_id_compression) {
+        pos += 2;
+    }
+    src_mac = buf + pos;
+    pos += addr_len[src_mode];
+
+    if (pos >= len) {
+        return -1;
+    }
+
+    if (buf[pos] == LOWPAN_IPV6_DISPATCH) {
+        pos++;
+        if (len - pos < IPV6_HEADER_LEN) {
+            return -1;
+        }
+        memcpy(ip, buf + pos, len - pos);
+        *ip_len = len - pos;
+        return 0;
+    }
+    if ((buf[pos] & 0xe0) == LOWPAN_IPHC_DISPATCH) {
+        return _decompress_iphc(buf + pos, len - pos, src_mac, addr_len[src_mode],
+                                dst_mac, addr_len[dst_mode], ip, ip_len);
+    }
+
+    /* fragments, mesh and broadcast headers aren't reassembled */
+    return -1;
+}
+
+/* RFC 6282 without contexts, which RIOT doesn't use by default */
+static int _decompress_iphc(uint8_t *buf, uint32_t len, uint8_t *src_mac, uint8_t src_mac_len,
+                            uint8_t *dst_mac, uint8_t dst_mac_len, uint8_t *ip, uint32_t *ip_len)
+{
+    uint8_t hop_limits[] = { 0, 1, 64, 255 };
+    uint8_t tf_len[] = { 4, 3, 1, 0 };
+    uint32_t pos = 2;
+    int used;
+
+    if (len < 2) {
+        return -1;
+    }
+    uint8_t tf = (buf[0] >> 3) & 0x3;
+    bool nh = buf[0] & 0x04;
+    uint8_t hlim = buf[0] & 0x03;
+    bool cid = buf[1] & 0x80;
+    bool sac = buf[1] & 0x40;
+    uint8_t sam = (buf[1] >> 4) & 0x3;
+    bool m = buf[1] & 0x08;
+    bool dac = buf[1] & 0x04;
+    uint8_t dam = buf[1] & 0x03;
+
+    if (cid || sac || dac) {
+        return -1;
+    }
+
+    memset(ip, 0, IPV6_HEADER_LEN);
+    ip[0] = 0x60;
+    /* traffic class and flow label don't matter to AODVv2 */
+    if (pos + tf_len[tf] > len) {
+        return -1;
+    }
+    pos += tf_len[tf];
+
+    if (!nh) {
+        if (pos >= len) {
+            return -1;
+        }
+        ip[6] = buf[pos++];
+    }
+    if (hlim == 0) {
+        if (pos >= len) {
+            return -1;
+        }
+        ip[7] = buf[pos++];
+    }
+    else {
+        ip[7] = hop_limits[hlim];
+    }
+
+    used = _decompress_addr(ip + 8, sam, buf + pos, len - pos, src_mac, src_mac_len);
+    if (used < 0) {
+        return -1;
+    }
+    pos += used;
+
+    if (m) {
+        used = _decompress_multicast(ip + 24, dam, buf + pos, len - pos);
+    }
+    else {
+        used = _decompress_addr(ip + 24, dam, buf + pos, len - pos, dst_mac, dst_mac_len);
+    }
+    if (used < 0) {
+        return -1;
+    }
+    pos += used;
+
+    uint8_t *udp = ip + IPV6_HEADER_LEN;
+    uint32_t header_len = IPV6_HEADER_LEN;
+
+    if (nh) {
+        /* only the UDP next header compression is supported */
+        if ((pos >= len) || ((buf[pos] & 0xf8) != LOWPAN_NHC_UDP)) {
+            return -1;
+        }
+        uint8_t nhc = buf[pos++];
+        uint8_t ports = nhc & 0x03;
+        uint8_t ports_len[] = { 4, 3, 3, 1 };
+        uint32_t checksum_len = (nhc & 0x04) ? 0 : 2;
+
+        if (pos + ports_len[ports] + checksum_len > len) {
+            return -1;
+        }
+        switch (ports) {
+            case 0:
+                memcpy(udp, buf + pos, 4);
+                break;
+            case 1:
+                memcpy(udp, buf + pos, 2);
+                _set_be16(udp + 2, 0xf000 | buf[pos + 2]);
+                break;
+            case 2:
+                _set_be16(udp, 0xf000 | buf[pos]);
+                memcpy(udp + 2, buf + pos + 1, 2);
+                break;
+            case 3:
+                _set_be16(udp, 0xf0b0 | (buf[pos] >> 4));
+                _set_be16(udp + 2, 0xf0b0 | (buf[pos] & 0x0f));
+                break;
+        }
+        pos += ports_len[ports];
+        if (checksum_len) {
+            memcpy(udp + 6, buf + pos, 2);
+            pos += 2;
+        }
+        _set_be16(udp + 4, UDP_HEADER_LEN + (len - pos));
+        ip[6] = IPPROTO_UDP_NUM;
+        header_len += UDP_HEADER_LEN;
+    }
+
+    /* ip is PCAP_MAX_RECORD bytes, and the headers may have grown by more
+     * than the 802.15.4 header we stripped */
+    if (header_len + (len - pos) > PCAP_MAX_RECORD) {
+        return -1;
+    }
+    memcpy(ip + header_len, buf + pos, len - pos);
+    *ip_len = header_len + (len - pos);
+    _set_be16(ip + 4, *ip_len - IPV6_HEADER_LEN);
+    return 0;
+}
+
+/* unicast address, or derived from the link layer address if elided */
+static int _decompress_addr(uint8_t *addr, uint8_t mode, uint8_t *buf, uint32_t len,
+                            uint8_t *mac, uint8_t mac_len)
+{
+    uint8_t inline_len[] = { 16, 8, 2, 0 };
+
+    if (inline_len[mode] > len) {
+        return -1;
+    }
+    if (mode == 0) {
+        memcpy(addr, buf, 16);
+        return 16;
+    }
+
+    addr[0] = 0xfe;
+    addr[1] = 0x80;
+    if (mode == 1) {
+        memcpy(addr + 8, buf, 8);
+    }
+    else if (mode == 2) {
+        addr[11] = 0xff;
+        addr[12] = 0xfe;
+        memcpy(addr + 14, buf, 2);
+    }
+    else if (mac_len == 2) {
+        /* link layer addresses are little endian in the frame */
+        addr[11] = 0xff;
+        addr[12] = 0xfe;
+        addr[14] = mac[1];
+        addr[15] = mac[0];
+    }
+    else if (mac_len == 8) {
+        for (int i = 0; i < 8; i++) {
+            addr[8 + i] = mac[7 - i];
+        }
+        addr[8] ^= 0x02;
+    }
+    else {
+        return -1;
+    }
+    return inline_len[mode];
+}
+
+static int _decompress_multicast(uint8_t *addr, uint8_t mode, uint8_t *buf, uint32_t len)
+{
+    uint8_t inline_len[] = { 16, 6, 4, 1 };
+
+    if (inline_len[mode] > len) {
+        return -1;
+    }
+    addr[0] = 0xff;
+    switch (mode) {
+        case 0:
+            memcpy(addr, buf, 16);
+            break;
+        case 1:
+            /* ffXX::00XX:XXXX:XXXX */
+            addr[1] = buf[0];
+            memcpy(addr + 11, buf + 1, 5);
+            break;
+        case 2:
+            /* ffXX::00XX:XXXX */
+            addr[1] = buf[0];
+            memcpy(addr + 13, buf + 1, 3);
+            break;
+        case 3:
+            /* ff02::00XX */
+            addr[1] = 0x02;
+            addr[15] = buf[0];
+            break;
+    }
+    return inline_len[mode];
+}
+
+/* walk the messages of an RFC 5444 packet and count the AODVv2 ones */
+static void _count_messages(uint8_t *buf, uint32_t len, struct virtualnetwork_replay_stats *stats)
+{
+    uint32_t pos = 1;
+
+    if ((len < 1) || ((buf[0] >> 4) != 0)) {
+        return;
+    }
+    if (buf[0] & RFC5444_PKT_HAS_SEQNUM) {
+        pos += 2;
+    }
+    if (buf[0] & RFC5444_PKT_HAS_TLV) {
+        if (pos + 2 > len) {
+            return;
+        }
+        pos += 2 + _get_be16(buf + pos);
+    }
+
+    /* <msg-type> <msg-flags/msg-addr-length> <msg-size> ... */
+    while (pos + 4 <= len) {
+        uint16_t size = _get_be16(buf + pos + 2);
+
+        switch (buf[pos]) {
+            case RFC5444_MSGTYPE_RREQ:
+                stats->rreq++;
+                break;
+            case RFC5444_MSGTYPE_RREP:
+                stats->rrep++;
+                break;
+            case RFC5444_MSGTYPE_RERR:
+                stats->rerr++;
+                break;
+        }
+
+        if (size < 4) {
+            return;
+        }
+        pos += size;
+    }
+}
+
+/* all neighbors of node, growing the list if it is full */
+static int _get_neighbors(uint16_t node, uint16_t **neighbors, uint16_t *max)
+{
+    int count;
+
+    /* a node has fewer than UINT16_MAX neighbors, so that list is never full */
+    while (((count = virtualnetwork_get_neighbors(node, *neighbors, *max)) == *max)
+           && (*max < UINT16_MAX)) {
+        uint16_t grown_max = (*max > UINT16_MAX / 2) ? UINT16_MAX : 2 * *max;
+        uint16_t *grown = realloc(*neighbors, grown_max * sizeof(**neighbors));
+        if (!grown) {
+            return -1;
+        }
+        *neighbors = grown;
+        *max = grown_max;
+    }
+    return count;
+}
+
+static uint32_t _get32(struct replay_capture *cap, uint8_t *p)
+{
+    if (cap->swapped) {
+        return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+    return ((uint32_t) p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static uint16_t _get_be16(uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void _set_be16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xff;
+}
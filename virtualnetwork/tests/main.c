@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     tests
+ * @{
+ *
+ * @file
+ * @brief       virtual network tests
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "net_help.h"
+
+#include "vn_tests.h"
+
+struct vn_test_rx vn_test_rx[VN_TEST_MAX_RX];
+unsigned vn_test_num_rx;
+
+static void _record(uint16_t node)
+{
+    uint8_t buf[VIRTUALNETWORK_MAX_PKT_SIZE];
+    sockaddr6_t from;
+    socklen_t fromlen;
+
+    while (virtualnetwork_recvfrom(0, buf, sizeof(buf), 0, &from, &fromlen) >= 0) {
+        if (vn_test_num_rx < VN_TEST_MAX_RX) {
+            struct vn_test_rx *rx = &vn_test_rx[vn_test_num_rx++];
+            rx->node = node;
+            rx->port = NTOHS(from.sin6_port);
+            rx->id = buf[0];
+            rx->time = virtualnetwork_now();
+        }
+    }
+}
+
+void vn_test_setup(uint16_t num_nodes)
+{
+    virtualnetwork_init(num_nodes);
+    virtualnetwork_set_channel(&virtualnetwork_channel_perfect);
+    virtualnetwork_set_seed(1);
+    virtualnetwork_set_receive_handler(_record);
+    virtualnetwork_set_routing_provider(NULL);
+    vn_test_num_rx = 0;
+}
+
+int vn_test_send(uint16_t node, int dest, uint16_t port, uint8_t id, uint32_t len)
+{
+    uint8_t buf[VIRTUALNETWORK_MAX_PKT_SIZE];
+    sockaddr6_t to = { .sin6_family = AF_INET6, .sin6_port = HTONS(port) };
+
+    if (dest < 0) {
+        /* ff02::1 */
+        memset(&to.sin6_addr, 0, sizeof(to.sin6_addr));
+        to.sin6_addr.uint8[0] = 0xff;
+        to.sin6_addr.uint8[1] = 0x02;
+        to.sin6_addr.uint8[15] = 0x01;
+    }
+    else {
+        virtualnetwork_get_addr(dest, &to.sin6_addr);
+    }
+
+    memset(buf, 0, len);
+    buf[0] = id;
+    virtualnetwork_set_current_node(node);
+    return virtualnetwork_sendto(0, buf, len, 0, &to, sizeof(to));
+}
+
+int main(void)
+{
+    test_queues_main();
+    test_channel_main();
+    test_threads_main();
+    test_replay_main();
+
+    virtualnetwork_destroy();
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+
+#include "cunit/cunit.h"
+
+#include "vn_tests.h"
+
+#define DATA_PORT   (1234)
+#define PKT_LEN     (40)
+#define LONG_PKT    (200)       /* longer on the air than the longest first backoff */
+
+/*
+ * 0 and 2 can't hear each other, so carrier sensing doesn't keep them from
+ * sending at the same time. Their frames overlap at 1, which loses both.
+ */
+static void test_hidden_terminal(void)
+{
+    vn_test_setup(3);
+    virtualnetwork_set_channel(&virtualnetwork_channel_802154);
+    virtualnetwork_add_link(0, 1);
+    virtualnetwork_add_link(1, 2);
+
+    START_TEST();
+    vn_test_send(0, 1, DATA_PORT, 0, PKT_LEN);
+    vn_test_send(2, 1, DATA_PORT, 2, PKT_LEN);
+    virtualnetwork_run(100000);
+
+    CHECK_TRUE(vn_test_num_rx == 0, "%u packets survived the collision\n", vn_test_num_rx);
+    END_TEST();
+}
+
+/* the same traffic gets through on the perfect channel */
+static void test_hidden_terminal_perfect(void)
+{
+    vn_test_setup(3);
+    virtualnetwork_add_link(0, 1);
+    virtualnetwork_add_link(1, 2);
+
+    START_TEST();
+    vn_test_send(0, 1, DATA_PORT, 0, PKT_LEN);
+    vn_test_send(2, 1, DATA_PORT, 2, PKT_LEN);
+    virtualnetwork_run(100000);
+
+    CHECK_TRUE(vn_test_num_rx == 2, "%u packets received instead of 2\n", vn_test_num_rx);
+    END_TEST();
+}
+
+/*
+ * Once 0 is on the air, 2 hears it and backs off until 0 is done, so both
+ * frames reach 1. 2 starts after 0's longest possible initial backoff and
+ * senses the channel while 0 is still sending.
+ */
+static void test_csma_defers(void)
+{
+    uint32_t max_backoff = ((1 << VIRTUALNETWORK_MIN_BE) - 1) * VIRTUALNETWORK_UNIT_BACKOFF;
+
+    vn_test_setup(3);
+    virtualnetwork_set_channel(&virtualnetwork_channel_802154);
+    virtualnetwork_add_link(0, 1);
+    virtualnetwork_add_link(1, 2);
+    virtualnetwork_add_link(0, 2);
+
+    START_TEST();
+    vn_test_send(0, 1, DATA_PORT, 0, LONG_PKT);
+    virtualnetwork_run(max_backoff + 1);
+    vn_test_send(2, 1, DATA_PORT, 2, LONG_PKT);
+    virtualnetwork_run(100000);
+
+    CHECK_TRUE(vn_test_num_rx == 2, "%u packets received instead of 2\n", vn_test_num_rx);
+    if (vn_test_num_rx == 2) {
+        CHECK_TRUE((vn_test_rx[0].id == 0) && (vn_test_rx[1].id == 2),
+                   "2 didn't wait for 0 to finish\n");
+    }
+    END_TEST();
+}
+
+/* airtime at 250 kbit/s including the frame overhead */
+static void test_airtime(void)
+{
+    uint32_t airtime = (PKT_LEN + VIRTUALNETWORK_FRAME_OVERHEAD) * 8 * 1000000 / VIRTUALNETWORK_BITRATE;
+    uint32_t max_backoff = ((1 << VIRTUALNETWORK_MIN_BE) - 1) * VIRTUALNETWORK_UNIT_BACKOFF;
+
+    vn_test_setup(2);
+    virtualnetwork_set_channel(&virtualnetwork_channel_802154);
+    virtualnetwork_add_link(0, 1);
+
+    START_TEST();
+    vn_test_send(0, 1, DATA_PORT, 0, PKT_LEN);
+    virtualnetwork_run(100000);
+
+    CHECK_TRUE(vn_test_num_rx == 1, "%u packets received instead of 1\n", vn_test_num_rx);
+    if (vn_test_num_rx == 1) {
+        CHECK_TRUE((vn_test_rx[0].time >= airtime) && (vn_test_rx[0].time <= airtime + max_backoff),
+                   "frame arrived at %u, airtime is %u\n", (unsigned) vn_test_rx[0].time, airtime);
+    }
+    END_TEST();
+}
+
+void test_channel_main(void)
+{
+    BEGIN_TESTING(NULL);
+
+    test_hidden_terminal();
+    test_hidden_terminal_perfect();
+    test_csma_defers();
+    test_airtime();
+
+    FINISH_TESTING();
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+
+#include "cunit/cunit.h"
+
+#include "vn_tests.h"
+
+#define DATA_PORT   (1234)
+#define PKT_LEN     (40)
+
+/* control messages that are queued after data overtake it */
+static void test_ctrl_before_data(void)
+{
+    vn_test_setup(2);
+    virtualnetwork_add_link(0, 1);
+
+    START_TEST();
+    /* the first frame goes on the air right away, the others have to wait */
+    for (uint8_t id = 0; id < 3; id++) {
+        vn_test_send(0, 1, DATA_PORT, id, PKT_LEN);
+    }
+    vn_test_send(0, 1, VIRTUALNETWORK_MANET_PORT, 10, PKT_LEN);
+    vn_test_send(0, 1, VIRTUALNETWORK_MANET_PORT, 11, PKT_LEN);
+    virtualnetwork_run(100 * VIRTUALNETWORK_FRAME_TIME);
+
+    uint8_t expected[] = { 0, 10, 11, 1, 2 };
+    CHECK_TRUE(vn_test_num_rx == sizeof(expected), "%u packets received instead of %u\n",
+               vn_test_num_rx, (unsigned) sizeof(expected));
+    for (unsigned i = 0; (i < vn_test_num_rx) && (i < sizeof(expected)); i++) {
+        CHECK_TRUE(vn_test_rx[i].id == expected[i], "packet %u is %u instead of %u\n",
+                   i, vn_test_rx[i].id, expected[i]);
+    }
+    END_TEST();
+}
+
+/* a full data queue drops new data, but still takes control messages */
+static void test_data_queue_full(void)
+{
+    int res;
+
+    vn_test_setup(2);
+    virtualnetwork_add_link(0, 1);
+
+    START_TEST();
+    /* one frame on the air plus a full queue */
+    for (uint8_t id = 0; id < VIRTUALNETWORK_DATA_QUEUE_LEN + 1; id++) {
+        res = vn_test_send(0, 1, DATA_PORT, id, PKT_LEN);
+        CHECK_TRUE(res == PKT_LEN, "data packet %u not queued\n", id);
+    }
+    res = vn_test_send(0, 1, DATA_PORT, 100, PKT_LEN);
+    CHECK_TRUE(res == -1, "data packet queued although the queue is full\n");
+    res = vn_test_send(0, 1, VIRTUALNETWORK_MANET_PORT, 101, PKT_LEN);
+    CHECK_TRUE(res == PKT_LEN, "control packet dropped because of the data queue\n");
+    virtualnetwork_run(100 * VIRTUALNETWORK_FRAME_TIME);
+
+    CHECK_TRUE(vn_test_num_rx == VIRTUALNETWORK_DATA_QUEUE_LEN + 2,
+               "%u packets received instead of %u\n", vn_test_num_rx, VIRTUALNETWORK_DATA_QUEUE_LEN + 2);
+    for (unsigned i = 0; i < vn_test_num_rx; i++) {
+        CHECK_TRUE(vn_test_rx[i].id != 100, "dropped packet was received\n");
+    }
+    END_TEST();
+}
+
+/* with the perfect channel, frames of one node follow each other back to back */
+static void test_frame_time(void)
+{
+    vn_test_setup(2);
+    virtualnetwork_add_link(0, 1);
+
+    START_TEST();
+    vn_test_send(0, 1, DATA_PORT, 0, PKT_LEN);
+    vn_test_send(0, 1, DATA_PORT, 1, PKT_LEN);
+    virtualnetwork_run(100 * VIRTUALNETWORK_FRAME_TIME);
+
+    CHECK_TRUE(vn_test_num_rx == 2, "%u packets received instead of 2\n", vn_test_num_rx);
+    CHECK_TRUE(vn_test_rx[0].time == VIRTUALNETWORK_FRAME_TIME, "first frame arrived at %u\n",
+               (unsigned) vn_test_rx[0].time);
+    CHECK_TRUE(vn_test_rx[1].time == 2 * VIRTUALNETWORK_FRAME_TIME, "second frame arrived at %u\n",
+               (unsigned) vn_test_rx[1].time);
+    END_TEST();
+}
+
+void test_queues_main(void)
+{
+    BEGIN_TESTING(NULL);
+
+    test_ctrl_before_data();
+    test_data_queue_full();
+    test_frame_time();
+
+    FINISH_TESTING();
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cunit/cunit.h"
+
+#include "vn_tests.h"
+
+#define CAPTURE_PATH        "/tmp/vn_test_replay.pcap"
+#define DATA_PORT           (1234)
+#define MAX_RECORD          (65535)
+
+/* Ethernet header, then RIOT native's <length> <dst> <src> */
+#define FRAME_OFFSET        (14 + 6)
+
+static FILE *_capture;
+
+static void _set_le32(uint8_t *p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = value >> (8 * i);
+    }
+}
+
+static void _open_capture(void)
+{
+    /* little endian pcap header, Ethernet */
+    uint8_t header[24] = { 0xd4, 0xc3, 0xb2, 0xa1, 2, 0, 4, 0 };
+
+    header[16] = 0xff;
+    header[17] = 0xff;
+    header[20] = 1;
+    _capture = fopen(CAPTURE_PATH, "wb");
+    fwrite(header, sizeof(header), 1, _capture);
+}
+
+/* write an 802.15.4 frame as RIOT native puts it on its tap interface */
+static void _write_frame(uint32_t seconds, const uint8_t *frame, uint16_t frame_len)
+{
+    uint8_t header[16 + FRAME_OFFSET];
+    uint32_t len = FRAME_OFFSET + frame_len;
+
+    memset(header, 0, sizeof(header));
+    _set_le32(header, seconds);
+    _set_le32(header + 8, len);
+    _set_le32(header + 12, len);
+    header[16 + 12] = 0x12;
+    header[16 + 13] = 0x34;
+    header[16 + 14] = frame_len >> 8;
+    header[16 + 15] = frame_len & 0xff;
+    fwrite(header, sizeof(header), 1, _capture);
+    fwrite(frame, frame_len, 1, _capture);
+}
+
+/*
+ * data frame from node src to node dst with short addresses and the IPv6 and
+ * UDP headers compressed as far as RIOT does. Traffic class and flow label
+ * and the hop limit are carried inline, so that truncated frames end in
+ * every kind of inline field. Returns the frame length, payload and FCS
+ * included.
+ */
+static uint16_t _build_frame(uint8_t *frame, uint16_t src, uint16_t dst, uint8_t id, uint16_t payload_len)
+{
+    uint16_t pos = 0;
+
+    /* data frame, PAN ID compression, short destination and source */
+    frame[pos++] = 0x41;
+    frame[pos++] = 0x88;
+    frame[pos++] = 0;
+    frame[pos++] = 0x23;
+    frame[pos++] = 0x00;
+    frame[pos++] = (dst + 1) & 0xff;
+    frame[pos++] = (dst + 1) >> 8;
+    frame[pos++] = (src + 1) & 0xff;
+    frame[pos++] = (src + 1) >> 8;
+
+    /* IPHC: TF inline, NH compressed, hop limit inline, both addresses elided */
+    frame[pos++] = 0x64;
+    frame[pos++] = 0x33;
+    memset(frame + pos, 0, 4);
+    pos += 4;
+    frame[pos++] = 64;
+
+    /* UDP NHC: both ports and the checksum inline */
+    frame[pos++] = 0xf0;
+    frame[pos++] = DATA_PORT >> 8;
+    frame[pos++] = DATA_PORT & 0xff;
+    frame[pos++] = DATA_PORT >> 8;
+    frame[pos++] = DATA_PORT & 0xff;
+    frame[pos++] = 0;
+    frame[pos++] = 0;
+
+    memset(frame + pos, 0, payload_len);
+    if (payload_len > 0) {
+        frame[pos] = id;
+    }
+    pos += payload_len;
+
+    /* FCS */
+    frame[pos++] = 0;
+    frame[pos++] = 0;
+    return pos;
+}
+
+/* frames that end inside their headers are skipped, the ones around them still replayed */
+static void test_replay_truncated(void)
+{
+    struct virtualnetwork_replay_stats stats;
+    uint8_t frame[64];
+    uint16_t full_len, headers_len;
+    unsigned truncated = 0;
+
+    vn_test_setup(2);
+    virtualnetwork_add_link(0, 1);
+
+    full_len = _build_frame(frame, 0, 1, 7, 1);
+    headers_len = full_len - 1;
+
+    _open_capture();
+    _write_frame(0, frame, full_len);
+    /* without its FCS, every one of these ends before the UDP payload */
+    for (uint16_t len = 0; len < headers_len; len++) {
+        _write_frame(0, frame, len);
+        truncated++;
+    }
+    _write_frame(0, frame, full_len);
+    fclose(_capture);
+
+    START_TEST();
+    int res = virtualnetwork_replay(CAPTURE_PATH, -1, false, &stats);
+    virtualnetwork_run(100 * VIRTUALNETWORK_FRAME_TIME);
+
+    CHECK_TRUE(res == 2, "%i packets replayed instead of 2\n", res);
+    CHECK_TRUE(stats.packets == truncated + 2, "%u records instead of %u\n",
+               (unsigned) stats.packets, truncated + 2);
+    CHECK_TRUE(stats.skipped == truncated, "%u records skipped instead of %u\n",
+               (unsigned) stats.skipped, truncated);
+    CHECK_TRUE(vn_test_num_rx == 2, "%u packets received instead of 2\n", vn_test_num_rx);
+    for (unsigned i = 0; i < vn_test_num_rx; i++) {
+        CHECK_TRUE((vn_test_rx[i].node == 1) && (vn_test_rx[i].id == 7),
+                   "node %u received packet %u\n", vn_test_rx[i].node, vn_test_rx[i].id);
+    }
+    END_TEST();
+
+    remove(CAPTURE_PATH);
+}
+
+/* a record that decompresses to more than a record can hold is skipped */
+static void test_replay_oversized(void)
+{
+    struct virtualnetwork_replay_stats stats;
+    uint8_t small[64];
+
+    vn_test_setup(2);
+    virtualnetwork_add_link(0, 1);
+
+    uint16_t max_frame_len = MAX_RECORD - FRAME_OFFSET;
+    uint8_t *frame = malloc(max_frame_len);
+    /* the IPv6 and UDP headers take 48 instead of 17 bytes once decompressed */
+    uint16_t headers_len = _build_frame(frame, 0, 1, 8, 0) - 2;
+    uint16_t len = _build_frame(frame, 0, 1, 8, max_frame_len - headers_len - 2);
+    uint16_t small_len = _build_frame(small, 0, 1, 9, 1);
+
+    _open_capture();
+    _write_frame(0, frame, len);
+    _write_frame(0, small, small_len);
+    fclose(_capture);
+    free(frame);
+
+    START_TEST();
+    int res = virtualnetwork_replay(CAPTURE_PATH, -1, false, &stats);
+    virtualnetwork_run(100 * VIRTUALNETWORK_FRAME_TIME);
+
+    CHECK_TRUE(res == 1, "%i packets replayed instead of 1\n", res);
+    CHECK_TRUE((stats.packets == 2) && (stats.skipped == 1), "%u records, %u skipped\n",
+               (unsigned) stats.packets, (unsigned) stats.skipped);
+    CHECK_TRUE((vn_test_num_rx == 1) && (vn_test_rx[0].id == 9), "oversized packet received\n");
+    END_TEST();
+
+    remove(CAPTURE_PATH);
+}
+
+/* a record older than the first one is injected right away, not in 2^64 us */
+static void test_replay_out_of_order(void)
+{
+    struct virtualnetwork_replay_stats stats;
+    uint8_t frame[64];
+
+    vn_test_setup(2);
+    virtualnetwork_add_link(0, 1);
+
+    _open_capture();
+    _write_frame(10, frame, _build_frame(frame, 0, 1, 1, 1));
+    _write_frame(9, frame, _build_frame(frame, 0, 1, 2, 1));
+    fclose(_capture);
+
+    START_TEST();
+    virtualnetwork_replay(CAPTURE_PATH, -1, true, &stats);
+    virtualnetwork_run(100 * VIRTUALNETWORK_FRAME_TIME);
+
+    CHECK_TRUE(vn_test_num_rx == 2, "%u packets received instead of 2\n", vn_test_num_rx);
+    END_TEST();
+
+    remove(CAPTURE_PATH);
+}
+
+void test_replay_main(void)
+{
+    BEGIN_TESTING(NULL);
+
+    test_replay_truncated();
+    test_replay_oversized();
+    test_replay_out_of_order();
+
+    FINISH_TESTING();
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "cunit/cunit.h"
+
+#include "vn_tests.h"
+
+#define GRID_SIZE       (6)
+#define NUM_NODES       (GRID_SIZE * GRID_SIZE)
+#define NUM_FLOODS      (8)
+#define MAX_TRACE       (NUM_FLOODS * 8)
+#define LINK_LATENCY    (200)       /* microseconds, lets the partitions run ahead */
+#define LINK_LOSS       (50)        /* per mille */
+#define PKT_LEN         (60)
+
+struct trace_entry {
+    uint64_t time;
+    uint8_t id;
+    uint8_t src[2];
+};
+
+/* everything the receive handler writes belongs to the node it is called
+ * for, so that it can run on several threads at once */
+struct node_trace {
+    bool seen[NUM_FLOODS];
+    unsigned num_entries;
+    struct trace_entry entries[MAX_TRACE];
+};
+
+static struct node_trace _traces[NUM_NODES];
+
+/* record every packet and rebroadcast each flood the first time it arrives */
+static void _flood(uint16_t node)
+{
+    uint8_t buf[VIRTUALNETWORK_MAX_PKT_SIZE];
+    struct node_trace *trace = &_traces[node];
+    sockaddr6_t from;
+    socklen_t fromlen;
+
+    while (virtualnetwork_recvfrom(0, buf, sizeof(buf), 0, &from, &fromlen) >= 0) {
+        uint8_t id = buf[0];
+
+        if (trace->num_entries < MAX_TRACE) {
+            struct trace_entry *entry = &trace->entries[trace->num_entries++];
+            entry->time = virtualnetwork_now();
+            entry->id = id;
+            entry->src[0] = from.sin6_addr.uint8[14];
+            entry->src[1] = from.sin6_addr.uint8[15];
+        }
+        if ((id < NUM_FLOODS) && !trace->seen[id]) {
+            trace->seen[id] = true;
+            vn_test_send(node, -1, VIRTUALNETWORK_MANET_PORT, id, PKT_LEN);
+        }
+    }
+}
+
+/* run the same floods on a lossy grid with the 802.15.4 channel.
+ * Returns the number of events processed. */
+static uint32_t _run(unsigned threads, struct node_trace *traces)
+{
+    uint32_t processed = 0;
+
+    vn_test_setup(NUM_NODES);
+    virtualnetwork_set_channel(&virtualnetwork_channel_802154);
+    virtualnetwork_set_seed(7);
+    virtualnetwork_set_threads(threads);
+    virtualnetwork_set_receive_handler(_flood);
+    memset(_traces, 0, sizeof(_traces));
+
+    for (uint16_t i = 0; i < GRID_SIZE; i++) {
+        for (uint16_t j = 0; j < GRID_SIZE; j++) {
+            uint16_t node = i * GRID_SIZE + j;
+            if (j + 1 < GRID_SIZE) {
+                virtualnetwork_add_link(node, node + 1);
+            }
+            if (i + 1 < GRID_SIZE) {
+                virtualnetwork_add_link(node, node + GRID_SIZE);
+            }
+        }
+    }
+    for (uint16_t node = 0; node < NUM_NODES; node++) {
+        uint16_t neighbors[4];
+        int num_neighbors = virtualnetwork_get_neighbors(node, neighbors, 4);
+        for (int k = 0; k < num_neighbors; k++) {
+            virtualnetwork_set_link_quality(node, neighbors[k], 0, LINK_LOSS, LINK_LATENCY);
+        }
+    }
+
+    /* floods start at different nodes, some of them at the same time */
+    for (uint8_t id = 0; id < NUM_FLOODS; id++) {
+        uint16_t origin = (id * 7) % NUM_NODES;
+        _traces[origin].seen[id] = true;
+        vn_test_send(origin, -1, VIRTUALNETWORK_MANET_PORT, id, PKT_LEN);
+        processed += virtualnetwork_run((id % 2) ? 3000 : 0);
+    }
+    processed += virtualnetwork_run(1000000);
+
+    memcpy(traces, _traces, sizeof(_traces));
+    virtualnetwork_set_threads(1);
+    return processed;
+}
+
+/* a run on several threads gives exactly the same events as a sequential one */
+static void test_parallel_equals_sequential(void)
+{
+    static struct node_trace sequential[NUM_NODES], parallel[NUM_NODES];
+    unsigned received = 0;
+
+    START_TEST();
+    uint32_t events = _run(1, sequential);
+    for (uint16_t node = 0; node < NUM_NODES; node++) {
+        received += sequential[node].num_entries;
+    }
+    CHECK_TRUE(received > NUM_NODES, "only %u packets received, the floods didn't spread\n", received);
+
+    for (unsigned threads = 2; threads <= 4; threads++) {
+        uint32_t parallel_events = _run(threads, parallel);
+        CHECK_TRUE(parallel_events == events, "%u events with %u threads instead of %u\n",
+                   (unsigned) parallel_events, threads, (unsigned) events);
+        for (uint16_t node = 0; node < NUM_NODES; node++) {
+            CHECK_TRUE(memcmp(&sequential[node], &parallel[node], sizeof(struct node_trace)) == 0,
+                       "node %u saw different events with %u threads\n", node, threads);
+        }
+    }
+    END_TEST();
+}
+
+void test_threads_main(void)
+{
+    BEGIN_TESTING(NULL);
+
+    test_parallel_equals_sequential();
+
+    FINISH_TESTING();
+}
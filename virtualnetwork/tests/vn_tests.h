@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2015
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     tests
+ * @{
+ *
+ * @file        vn_tests.h
+ * @brief       tests of the virtual network
+ */
+
+#ifndef VN_TESTS_H_
+#define VN_TESTS_H_
+
+#include <stdint.h>
+
+#include "virtualnetwork.h"
+
+/* what a receive handler took out of the inboxes, in the order it arrived */
+struct vn_test_rx {
+    uint16_t node;
+    uint16_t port;
+    uint8_t id;             /* first payload byte */
+    uint64_t time;
+};
+
+#define VN_TEST_MAX_RX      (64)
+
+extern struct vn_test_rx vn_test_rx[VN_TEST_MAX_RX];
+extern unsigned vn_test_num_rx;
+
+/**
+ * @brief   Set up num_nodes nodes that record every packet they receive in
+ *          vn_test_rx.
+ */
+void vn_test_setup(uint16_t num_nodes);
+
+/**
+ * @brief   Send a packet of len bytes whose first byte is id from node to
+ *          node dest (-1: all neighbors).
+ *
+ * @return  result of virtualnetwork_sendto()
+ */
+int vn_test_send(uint16_t node, int dest, uint16_t port, uint8_t id, uint32_t len);
+
+void test_queues_main(void);
+void test_channel_main(void);
+void test_threads_main(void);
+void test_replay_main(void);
+
+#endif /* VN_TESTS_H_ */
+/** @} */
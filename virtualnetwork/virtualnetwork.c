@@ -1,21 +1,1367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "net_help.h"
+
 #include "virtualnetwork.h"
 
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#define BROADCAST (-1)
+
+enum vn_event_type {
+    EVENT_CCA,                  /* backoff is over, sense the channel */
+    EVENT_TX_DONE,
+    EVENT_RX_START,
+    EVENT_RX_END,
+    EVENT_INJECT,               /* packet from outside the network, e.g. a capture */
+};
+
+struct vn_packet {
+    uint64_t enqueued;          /* when the packet entered the transmit queue */
+    ipv6_addr_t src;
+    ipv6_addr_t dst;
+    uint16_t port;
+    int32_t next_hop;           /* link layer receiver, BROADCAST for all neighbors */
+    uint8_t iface;              /* interface the packet is sent on */
+    uint32_t airtime;           /* microseconds */
+    uint64_t rx_end;            /* when the last bit arrives at the receiver */
+    bool lost;                  /* dropped by the link to the receiver */
+    uint16_t len;
+    uint8_t data[VIRTUALNETWORK_MAX_PKT_SIZE];
+};
+
+struct vn_queue {
+    struct vn_packet **slots;
+    uint16_t size;
+    uint16_t head;
+    uint16_t count;
+    uint32_t enqueued;
+    uint32_t sent;
+    uint32_t dropped;
+    uint16_t max_depth;
+    uint64_t total_wait;        /* microseconds */
+    uint64_t max_wait;          /* microseconds */
+};
+
+struct vn_link {
+    uint16_t node;
+    uint8_t iface;              /* interface of the local end */
+    uint16_t loss;              /* per mille of the frames sent over this link */
+    uint32_t latency;           /* microseconds */
+};
+
+/* every interface is a radio of its own with its own transmit queues */
+struct vn_iface {
+    struct vn_queue queues[VIRTUALNETWORK_CLASS_NUMOF];
+    struct vn_packet *transmitting;     /* also set while backing off */
+    uint8_t backoffs;                   /* NB of the frame being sent */
+    uint8_t backoff_exponent;           /* BE of the frame being sent */
+    uint64_t tx_until;
+    uint16_t receiving;                 /* frames currently arriving */
+    uint64_t rx_until;                  /* end of the last frame arriving */
+    uint64_t collision_until;           /* frames ending before this collided */
+    uint32_t frames;
+    uint64_t airtime;
+    uint32_t num_backoffs, num_csma_drops, num_collisions, num_losses;
+};
+
+struct vn_node {
+    struct vn_link *neighbors;
+    uint16_t num_neighbors;
+    uint16_t max_neighbors;
+    struct vn_iface ifaces[VIRTUALNETWORK_MAX_IFACES];
+    struct vn_packet *inbox[VIRTUALNETWORK_INBOX_LEN];
+    uint16_t inbox_head;
+    uint16_t inbox_count;
+    uint32_t inbox_dropped;
+    uint32_t no_route;
+    uint32_t rng;               /* every node draws from its own random sequence */
+    uint64_t event_seq;         /* number of events this node has scheduled */
+    uint16_t partition;
+};
+
+/* Events at the same time are ordered by the node that scheduled them and
+ * the order in which it did. This order doesn't depend on how the nodes are
+ * split into partitions, so parallel runs process every node's events in the
+ * same order as a sequential run. */
+struct vn_event {
+    uint64_t time;
+    uint16_t origin;
+    uint64_t seq;
+    enum vn_event_type type;
+    uint16_t node;
+    uint8_t iface;
+    struct vn_packet *pkt;
+};
+
+struct vn_events {
+    struct vn_event *events;
+    uint32_t num_events;
+    uint32_t max_events;
+};
+
+/* the nodes that one thread simulates */
+struct vn_partition {
+    struct vn_events heap;
+    struct vn_events *outboxes;     /* events for nodes of other partitions, one per partition */
+    uint32_t processed;
+};
+
+static struct vn_node *_nodes;
+static uint16_t _num_nodes;
+static __thread uint16_t _current;
+static __thread uint64_t _now;
+
+static struct vn_partition *_partitions;
+static uint16_t _num_partitions;
+static unsigned _num_threads = 1;
+static __thread struct vn_partition *_partition;   /* partition the calling thread simulates */
+
+/* state of a parallel run, shared by all workers */
+static bool _parallel;
+static pthread_barrier_t _barrier;
+static pthread_mutex_t _start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _start_cond = PTHREAD_COND_INITIALIZER;
+static bool _started;
+static uint64_t _run_end, _window_end;
+static uint32_t _lookahead;
+static bool _stop;
+
+static virtualnetwork_channel_t _channel = {
+    .bitrate = 0,
+    .overhead = 0,
+    .collisions = false,
+    .csma = false,
+};
+static uint32_t _seed = 1;
+
+const virtualnetwork_channel_t virtualnetwork_channel_perfect = {
+    .bitrate = 0,
+    .overhead = 0,
+    .collisions = false,
+    .csma = false,
+};
+
+const virtualnetwork_channel_t virtualnetwork_channel_802154 = {
+    .bitrate = VIRTUALNETWORK_BITRATE,
+    .overhead = VIRTUALNETWORK_FRAME_OVERHEAD,
+    .collisions = true,
+    .csma = true,
+};
+
+static virtualnetwork_receive_handler_t _receive_handler;
+static ipv6_addr_t *(*_next_hop)(ipv6_addr_t *dest);
+
+static const char *_class_names[VIRTUALNETWORK_CLASS_NUMOF] = {
+    [VIRTUALNETWORK_CLASS_CTRL] = "control",
+    [VIRTUALNETWORK_CLASS_DATA] = "data",
+};
+
+static int _link_iface(uint16_t node, uint16_t other);
+static int _route(uint16_t node, struct vn_packet *pkt);
+static int _enqueue(uint16_t node, struct vn_packet *pkt);
+static int _enqueue_broadcast(uint16_t node, struct vn_packet *pkt);
+static void _start_tx(uint16_t node, uint8_t iface);
+static void _cca(uint16_t node, uint8_t iface);
+static void _transmit(uint16_t node, uint8_t iface);
+static void _tx_done(uint16_t node, uint8_t iface);
+static void _rx_start(uint16_t node, struct vn_packet *pkt);
+static void _rx_end(uint16_t node, struct vn_packet *pkt);
+static uint32_t _airtime(uint16_t len);
+static uint32_t _backoff(uint16_t node, uint8_t exponent);
+static uint32_t _random(uint16_t node);
+static void _seed_nodes(void);
+static void _receive(uint16_t node, struct vn_packet *pkt);
+static void _deliver(uint16_t node, struct vn_packet *pkt);
+static int _schedule(uint64_t time, enum vn_event_type type, uint16_t node, uint8_t iface,
+                     struct vn_packet *pkt, uint16_t origin);
+static void _dispatch(struct vn_event *event);
+static uint32_t _run_sequential(void);
+static uint32_t _run_parallel(void);
+static void *_worker(void *arg);
+static void _run_partition(uint16_t p);
+static void _next_window(void);
+static uint32_t _get_lookahead(void);
+static int _setup_partitions(void);
+static void _free_partitions(void);
+static bool _before(struct vn_event *a, struct vn_event *b);
+static int _append(struct vn_events *events, struct vn_event *event);
+static int _push_event(struct vn_events *heap, struct vn_event *event);
+static void _pop_event(struct vn_events *heap, struct vn_event *event);
+
+int virtualnetwork_init(uint16_t num_nodes)
+{
+    virtualnetwork_destroy();
+
+    _nodes = calloc(num_nodes, sizeof(struct vn_node));
+    if (!_nodes) {
+        return -1;
+    }
+    _num_nodes = num_nodes;
+
+    for (uint16_t i = 0; i < num_nodes; i++) {
+        for (int f = 0; f < VIRTUALNETWORK_MAX_IFACES; f++) {
+            struct vn_iface *iface = &_nodes[i].ifaces[f];
+            iface->queues[VIRTUALNETWORK_CLASS_CTRL].size = VIRTUALNETWORK_CTRL_QUEUE_LEN;
+            iface->queues[VIRTUALNETWORK_CLASS_DATA].size = VIRTUALNETWORK_DATA_QUEUE_LEN;
+
+            for (int c = 0; c < VIRTUALNETWORK_CLASS_NUMOF; c++) {
+                struct vn_queue *queue = &iface->queues[c];
+                queue->slots = calloc(queue->size, sizeof(struct vn_packet *));
+                if (!queue->slots) {
+                    virtualnetwork_destroy();
+                    return -1;
+                }
+            }
+        }
+    }
+    _seed_nodes();
+
+    if (_setup_partitions() < 0) {
+        virtualnetwork_destroy();
+        return -1;
+    }
+    return 0;
+}
+
+void virtualnetwork_destroy(void)
+{
+    for (uint16_t i = 0; i < _num_nodes; i++) {
+        struct vn_node *n = &_nodes[i];
+
+        for (int f = 0; f < VIRTUALNETWORK_MAX_IFACES; f++) {
+            for (int c = 0; c < VIRTUALNETWORK_CLASS_NUMOF; c++) {
+                struct vn_queue *queue = &n->ifaces[f].queues[c];
+                for (uint16_t j = 0; j < queue->count; j++) {
+                    free(queue->slots[(queue->head + j) % queue->size]);
+                }
+                free(queue->slots);
+            }
+            free(n->ifaces[f].transmitting);
+        }
+        for (uint16_t j = 0; j < n->inbox_count; j++) {
+            free(n->inbox[(n->inbox_head + j) % VIRTUALNETWORK_INBOX_LEN]);
+        }
+        free(n->neighbors);
+    }
+    _free_partitions();
+
+    free(_nodes);
+    _nodes = NULL;
+    _num_nodes = 0;
+    _current = 0;
+    _now = 0;
+}
+
+int virtualnetwork_set_threads(unsigned threads)
+{
+    struct vn_events pending = { NULL, 0, 0 };
+    struct vn_event event;
+    int res = 0;
+
+    if (threads == 0) {
+        return -1;
+    }
+    _num_threads = threads;
+    if (!_nodes) {
+        return 0;
+    }
+
+    /* move the scheduled events over to the new partitions */
+    for (uint16_t p = 0; p < _num_partitions; p++) {
+        while (_partitions[p].heap.num_events > 0) {
+            _pop_event(&_partitions[p].heap, &event);
+            if (_append(&pending, &event) < 0) {
+                free(event.pkt);
+                res = -1;
+            }
+        }
+    }
+    _free_partitions();
+
+    if (_setup_partitions() < 0) {
+        res = -1;
+    }
+    for (uint32_t i = 0; i < pending.num_events; i++) {
+        struct vn_event *e = &pending.events[i];
+        if ((res < 0) || (_push_event(&_partitions[_nodes[e->node].partition].heap, e) < 0)) {
+            free(e->pkt);
+            res = -1;
+        }
+    }
+    free(pending.events);
+    return res;
+}
+
+int virtualnetwork_add_link(uint16_t a, uint16_t b)
+{
+    return virtualnetwork_add_iface_link(a, b, 0);
+}
+
+int virtualnetwork_add_iface_link(uint16_t a, uint16_t b, uint8_t iface)
+{
+    uint16_t ends[2][2] = {{a, b}, {b, a}};
+
+    if ((a >= _num_nodes) || (b >= _num_nodes) || (a == b)
+        || (iface >= VIRTUALNETWORK_MAX_IFACES)) {
+        return -1;
+    }
+
+    for (uint16_t i = 0; i < _nodes[a].num_neighbors; i++) {
+        if ((_nodes[a].neighbors[i].node == b) && (_nodes[a].neighbors[i].iface == iface)) {
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        struct vn_node *n = &_nodes[ends[i][0]];
+
+        if (n->num_neighbors == n->max_neighbors) {
+            uint16_t max = (n->max_neighbors > 0) ? n->max_neighbors * 2 : 8;
+            struct vn_link *neighbors = realloc(n->neighbors, max * sizeof(struct vn_link));
+            if (!neighbors) {
+                return -1;
+            }
+            n->neighbors = neighbors;
+            n->max_neighbors = max;
+        }
+        n->neighbors[n->num_neighbors].node = ends[i][1];
+        n->neighbors[n->num_neighbors].iface = iface;
+        n->neighbors[n->num_neighbors].loss = 0;
+        n->neighbors[n->num_neighbors].latency = 0;
+        n->num_neighbors++;
+    }
+    return 0;
+}
+
+int virtualnetwork_set_link_quality(uint16_t from, uint16_t to, uint8_t iface,
+                                    uint16_t loss, uint32_t latency)
+{
+    if ((from >= _num_nodes) || (loss > 1000)) {
+        return -1;
+    }
+
+    for (uint16_t i = 0; i < _nodes[from].num_neighbors; i++) {
+        struct vn_link *link = &_nodes[from].neighbors[i];
+        if ((link->node == to) && (link->iface == iface)) {
+            link->loss = loss;
+            link->latency = latency;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void virtualnetwork_set_channel(const virtualnetwork_channel_t *channel)
+{
+    _channel = *channel;
+}
+
+void virtualnetwork_set_seed(uint32_t seed)
+{
+    _seed = seed;
+    _seed_nodes();
+}
+
+int virtualnetwork_load_topology(const char *path)
+{
+    char line[64];
+    unsigned num_nodes, a, b, iface;
+    int res = -1;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "# nodes %u", &num_nodes) == 1) {
+            if ((num_nodes > UINT16_MAX) || (virtualnetwork_init(num_nodes) < 0)) {
+                break;
+            }
+            res = num_nodes;
+        }
+        else if (line[0] == '#') {
+            continue;
+        }
+        else if (res < 0) {
+            /* links before the number of nodes */
+            break;
+        }
+        else {
+            int fields = sscanf(line, "%u %u %u", &a, &b, &iface);
+            if (fields == 2) {
+                iface = 0;
+            }
+            if ((fields < 2) || (a > UINT16_MAX) || (b > UINT16_MAX) || (iface > UINT8_MAX)
+                || (virtualnetwork_add_iface_link(a, b, iface) < 0)) {
+                DEBUG("[virtualnetwork] %s: bad link: %s", path, line);
+                res = -1;
+                break;
+            }
+        }
+    }
+
+    fclose(f);
+    if (res < 0) {
+        virtualnetwork_destroy();
+    }
+    return res;
+}
+
+int virtualnetwork_get_neighbors(uint16_t node, uint16_t *neighbors, uint16_t max)
+{
+    uint16_t count = 0;
+
+    if (node >= _num_nodes) {
+        return -1;
+    }
+
+    /* a neighbor linked on several interfaces is only listed once */
+    for (uint16_t i = 0; (i < _nodes[node].num_neighbors) && (count < max); i++) {
+        uint16_t neighbor = _nodes[node].neighbors[i].node;
+        bool listed = false;
+        for (uint16_t j = 0; j < count; j++) {
+            listed |= (neighbors[j] == neighbor);
+        }
+        if (!listed) {
+            neighbors[count++] = neighbor;
+        }
+    }
+    return count;
+}
+
+void virtualnetwork_get_addr(uint16_t node, ipv6_addr_t *addr)
+{
+    uint16_t suffix = node + 1;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->uint8[0] = 0xfe;
+    addr->uint8[1] = 0x80;
+    addr->uint8[11] = 0xff;
+    addr->uint8[12] = 0xfe;
+    addr->uint8[14] = suffix >> 8;
+    addr->uint8[15] = suffix & 0xff;
+}
+
+int virtualnetwork_get_node(ipv6_addr_t *addr)
+{
+    ipv6_addr_t node_addr;
+    int node = ((addr->uint8[14] << 8) | addr->uint8[15]) - 1;
+
+    if ((node < 0) || (node >= _num_nodes)) {
+        return -1;
+    }
+    virtualnetwork_get_addr(node, &node_addr);
+    return (memcmp(addr, &node_addr, sizeof(node_addr)) == 0) ? node : -1;
+}
+
+void virtualnetwork_set_current_node(uint16_t node)
+{
+    _current = node;
+}
+
+uint16_t virtualnetwork_get_current_node(void)
+{
+    return _current;
+}
+
+void virtualnetwork_set_receive_handler(virtualnetwork_receive_handler_t handler)
+{
+    _receive_handler = handler;
+}
+
+uint64_t virtualnetwork_now(void)
+{
+    return _now;
+}
+
+uint32_t virtualnetwork_run(uint64_t duration)
+{
+    uint32_t processed;
+
+    _run_end = _now + duration;
+    _lookahead = _get_lookahead();
+
+    /* without lookahead, every event could affect another partition at the
+     * same time, so the partitions can't run ahead of each other */
+    if ((_num_partitions > 1) && (_lookahead > 0)) {
+        processed = _run_parallel();
+    }
+    else {
+        processed = _run_sequential();
+    }
+
+    _now = _run_end;
+    return processed;
+}
+
+void virtualnetwork_print_stats(void)
+{
+    uint32_t inbox_dropped = 0, no_route = 0;
+
+    printf("class    enqueued      sent   dropped  max depth  avg wait (us)  max wait (us)\n");
+    for (int c = 0; c < VIRTUALNETWORK_CLASS_NUMOF; c++) {
+        uint32_t enqueued = 0, sent = 0, dropped = 0;
+        uint16_t max_depth = 0;
+        uint64_t total_wait = 0, max_wait = 0;
+
+        for (uint16_t i = 0; i < _num_nodes; i++) {
+            for (int f = 0; f < VIRTUALNETWORK_MAX_IFACES; f++) {
+                struct vn_queue *queue = &_nodes[i].ifaces[f].queues[c];
+                enqueued += queue->enqueued;
+                sent += queue->sent;
+                dropped += queue->dropped;
+                total_wait += queue->total_wait;
+                max_depth = (queue->max_depth > max_depth) ? queue->max_depth : max_depth;
+                max_wait = (queue->max_wait > max_wait) ? queue->max_wait : max_wait;
+            }
+        }
+        printf("%-7s  %8" PRIu32 "  %8" PRIu32 "  %8" PRIu32 "  %9" PRIu16 "  %13" PRIu64 "  %13" PRIu64 "\n",
+               _class_names[c], enqueued, sent, dropped, max_depth,
+               (sent > 0) ? total_wait / sent : 0, max_wait);
+    }
+
+    uint32_t backoffs = 0, csma_drops = 0, collisions = 0, losses = 0;
+    uint64_t airtime = 0;
+
+    printf("frames sent per interface:");
+    for (int f = 0; f < VIRTUALNETWORK_MAX_IFACES; f++) {
+        uint32_t frames = 0;
+        for (uint16_t i = 0; i < _num_nodes; i++) {
+            struct vn_iface *iface = &_nodes[i].ifaces[f];
+            frames += iface->frames;
+            airtime += iface->airtime;
+            backoffs += iface->num_backoffs;
+            csma_drops += iface->num_csma_drops;
+            collisions += iface->num_collisions;
+            losses += iface->num_losses;
+        }
+        printf(" %i: %" PRIu32, f, frames);
+    }
+    printf("\n");
+    printf("airtime: %" PRIu64 " us, backoffs: %" PRIu32 ", dropped after %i backoffs: %" PRIu32
+           ", lost to collisions: %" PRIu32 ", lost on links: %" PRIu32 "\n",
+           airtime, backoffs, VIRTUALNETWORK_MAX_BACKOFFS, csma_drops, collisions, losses);
+
+    for (uint16_t i = 0; i < _num_nodes; i++) {
+        inbox_dropped += _nodes[i].inbox_dropped;
+        no_route += _nodes[i].no_route;
+    }
+    printf("dropped for lack of a route: %" PRIu32 ", dropped at full inbox: %" PRIu32 "\n",
+           no_route, inbox_dropped);
+}
+
 int virtualnetwork_sendto(int s, const void *buf, uint32_t len, int flags,
                               sockaddr6_t *to, socklen_t tolen)
 {
     (void)s;
-    (void)buf;
-    (void)len;
     (void)flags;
-    (void)to;
     (void)tolen;
 
-    printf("%s: IMPLEMENT ME!\n", __func__);
-    return 1;
+    if ((len > VIRTUALNETWORK_MAX_PKT_SIZE) || (_current >= _num_nodes)) {
+        return -1;
+    }
+
+    struct vn_packet *pkt = malloc(sizeof(struct vn_packet));
+    if (!pkt) {
+        return -1;
+    }
+
+    virtualnetwork_get_addr(_current, &pkt->src);
+    pkt->dst = to->sin6_addr;
+    pkt->port = NTOHS(to->sin6_port);
+    pkt->len = len;
+    memcpy(pkt->data, buf, len);
+
+    if (to->sin6_addr.uint8[0] == 0xff) {
+        return (_enqueue_broadcast(_current, pkt) == 0) ? (int) len : -1;
+    }
+
+    if (_route(_current, pkt) < 0) {
+        _nodes[_current].no_route++;
+        free(pkt);
+        return -1;
+    }
+    return (_enqueue(_current, pkt) == 0) ? (int) len : -1;
+}
+
+int virtualnetwork_inject(uint16_t node, uint64_t time, ipv6_addr_t *src, ipv6_addr_t *dst,
+                          uint16_t port, const void *buf, uint32_t len)
+{
+    if ((node >= _num_nodes) || (len > VIRTUALNETWORK_MAX_PKT_SIZE)) {
+        return -1;
+    }
+
+    struct vn_packet *pkt = malloc(sizeof(struct vn_packet));
+    if (!pkt) {
+        return -1;
+    }
+
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->src = *src;
+    pkt->dst = *dst;
+    pkt->port = port;
+    pkt->next_hop = node;
+    pkt->len = len;
+    memcpy(pkt->data, buf, len);
+
+    if (_schedule((time > _now) ? time : _now, EVENT_INJECT, node, 0, pkt, node) < 0) {
+        free(pkt);
+        return -1;
+    }
+    return 0;
 }
 
 void virtualnetwork_set_routing_provider(ipv6_addr_t *(*next_hop)(ipv6_addr_t *dest))
 {
-    (void)next_hop;
-    printf("%s: IMPLEMENT ME!\n", __func__);
+    _next_hop = next_hop;
+}
+
+int32_t virtualnetwork_recvfrom(int s, void *buf, uint32_t len, int flags,
+                                sockaddr6_t *from, socklen_t *fromlen)
+{
+    (void)s;
+    (void)flags;
+
+    if (_current >= _num_nodes) {
+        return -1;
+    }
+
+    struct vn_node *n = &_nodes[_current];
+    if (n->inbox_count == 0) {
+        return -1;
+    }
+
+    struct vn_packet *pkt = n->inbox[n->inbox_head];
+    n->inbox_head = (n->inbox_head + 1) % VIRTUALNETWORK_INBOX_LEN;
+    n->inbox_count--;
+
+    uint32_t copied = (pkt->len < len) ? pkt->len : len;
+    memcpy(buf, pkt->data, copied);
+    if (from) {
+        from->sin6_family = AF_INET6;
+        from->sin6_port = HTONS(pkt->port);
+        from->sin6_addr = pkt->src;
+    }
+    if (fromlen) {
+        *fromlen = sizeof(sockaddr6_t);
+    }
+
+    free(pkt);
+    return copied;
+}
+
+/*
+ * Get the interface node reaches other on, -1 if they aren't neighbors. If
+ * other can be reached on several interfaces, the one with the fewest frames
+ * waiting is used, so that traffic spreads across all radios.
+ */
+static int _link_iface(uint16_t node, uint16_t other)
+{
+    struct vn_node *n = &_nodes[node];
+    int best = -1;
+    uint32_t best_backlog = 0;
+
+    for (uint16_t i = 0; i < n->num_neighbors; i++) {
+        if (n->neighbors[i].node != other) {
+            continue;
+        }
+
+        struct vn_iface *iface = &n->ifaces[n->neighbors[i].iface];
+        uint32_t backlog = (iface->transmitting ? 1 : 0);
+        for (int c = 0; c < VIRTUALNETWORK_CLASS_NUMOF; c++) {
+            backlog += iface->queues[c].count;
+        }
+
+        if ((best < 0) || (backlog < best_backlog)) {
+            best = n->neighbors[i].iface;
+            best_backlog = backlog;
+        }
+    }
+    return best;
+}
+
+/* choose the next hop and interface for a unicast packet sent or forwarded by node */
+static int _route(uint16_t node, struct vn_packet *pkt)
+{
+    int dest = virtualnetwork_get_node(&pkt->dst);
+    int iface = (dest >= 0) ? _link_iface(node, dest) : -1;
+
+    if (iface < 0) {
+        ipv6_addr_t *next_hop = _next_hop ? _next_hop(&pkt->dst) : NULL;
+        dest = next_hop ? virtualnetwork_get_node(next_hop) : -1;
+        iface = (dest >= 0) ? _link_iface(node, dest) : -1;
+    }
+
+    if (iface < 0) {
+        return -1;
+    }
+    pkt->next_hop = dest;
+    pkt->iface = iface;
+    return 0;
+}
+
+/* put pkt into the transmit queue of its class. Data that doesn't fit is
+ * dropped right away instead of pushing back control messages. */
+static int _enqueue(uint16_t node, struct vn_packet *pkt)
+{
+    virtualnetwork_class_t cls = (pkt->port == VIRTUALNETWORK_MANET_PORT) ?
+                                 VIRTUALNETWORK_CLASS_CTRL : VIRTUALNETWORK_CLASS_DATA;
+    struct vn_iface *iface = &_nodes[node].ifaces[pkt->iface];
+    struct vn_queue *queue = &iface->queues[cls];
+
+    if (queue->count == queue->size) {
+        queue->dropped++;
+        free(pkt);
+        return -1;
+    }
+
+    pkt->enqueued = _now;
+    queue->slots[(queue->head + queue->count) % queue->size] = pkt;
+    queue->count++;
+    queue->enqueued++;
+    if (queue->count > queue->max_depth) {
+        queue->max_depth = queue->count;
+    }
+
+    if (!iface->transmitting) {
+        _start_tx(node, pkt->iface);
+    }
+    return 0;
+}
+
+/* a multicast packet is sent once on every interface that has links */
+static int _enqueue_broadcast(uint16_t node, struct vn_packet *pkt)
+{
+    struct vn_node *n = &_nodes[node];
+    bool used[VIRTUALNETWORK_MAX_IFACES] = { false };
+    int res = -1;
+
+    for (uint16_t i = 0; i < n->num_neighbors; i++) {
+        used[n->neighbors[i].iface] = true;
+    }
+
+    pkt->next_hop = BROADCAST;
+    for (int f = 0; f < VIRTUALNETWORK_MAX_IFACES; f++) {
+        if (!used[f]) {
+            continue;
+        }
+
+        struct vn_packet *copy = malloc(sizeof(struct vn_packet));
+        if (copy) {
+            memcpy(copy, pkt, sizeof(struct vn_packet));
+            copy->iface = f;
+            if (_enqueue(node, copy) == 0) {
+                res = 0;
+            }
+        }
+    }
+    free(pkt);
+    return res;
+}
+
+/* strict priority: data is only sent while no control message is waiting */
+static void _start_tx(uint16_t node, uint8_t f)
+{
+    struct vn_iface *iface = &_nodes[node].ifaces[f];
+
+    for (int c = 0; c < VIRTUALNETWORK_CLASS_NUMOF; c++) {
+        struct vn_queue *queue = &iface->queues[c];
+
+        if (queue->count == 0) {
+            continue;
+        }
+
+        struct vn_packet *pkt = queue->slots[queue->head];
+        queue->head = (queue->head + 1) % queue->size;
+        queue->count--;
+        queue->sent++;
+
+        uint64_t wait = _now - pkt->enqueued;
+        queue->total_wait += wait;
+        if (wait > queue->max_wait) {
+            queue->max_wait = wait;
+        }
+
+        iface->transmitting = pkt;
+        iface->backoffs = 0;
+        iface->backoff_exponent = VIRTUALNETWORK_MIN_BE;
+
+        if (!_channel.csma) {
+            _transmit(node, f);
+        }
+        else if (_schedule(_now + _backoff(node, iface->backoff_exponent), EVENT_CCA, node, f, NULL, node) < 0) {
+            iface->transmitting = NULL;
+            free(pkt);
+        }
+        return;
+    }
+}
+
+/* unslotted CSMA-CA as in IEEE 802.15.4: send if no frame is arriving,
+ * otherwise back off for longer and longer, up to VIRTUALNETWORK_MAX_BACKOFFS times */
+static void _cca(uint16_t node, uint8_t f)
+{
+    struct vn_iface *iface = &_nodes[node].ifaces[f];
+
+    if (iface->receiving == 0) {
+        _transmit(node, f);
+        return;
+    }
+
+    iface->num_backoffs++;
+    if (++iface->backoffs > VIRTUALNETWORK_MAX_BACKOFFS) {
+        iface->num_csma_drops++;
+        free(iface->transmitting);
+        iface->transmitting = NULL;
+        _start_tx(node, f);
+        return;
+    }
+
+    if (iface->backoff_exponent < VIRTUALNETWORK_MAX_BE) {
+        iface->backoff_exponent++;
+    }
+    if (_schedule(_now + _backoff(node, iface->backoff_exponent), EVENT_CCA, node, f, NULL, node) < 0) {
+        free(iface->transmitting);
+        iface->transmitting = NULL;
+    }
+}
+
+/*
+ * Put the frame on the air. Every neighbor on the interface receives it,
+ * since even frames addressed to someone else occupy its channel. Whether the
+ * link loses the frame is decided by the sender, so that the outcome only
+ * depends on the sender's random sequence.
+ */
+static void _transmit(uint16_t node, uint8_t f)
+{
+    struct vn_node *n = &_nodes[node];
+    struct vn_iface *iface = &n->ifaces[f];
+    struct vn_packet *pkt = iface->transmitting;
+
+    pkt->airtime = _airtime(pkt->len);
+    iface->frames++;
+    iface->airtime += pkt->airtime;
+    iface->tx_until = _now + pkt->airtime;
+
+    /* the radio is half-duplex: whatever it is receiving right now is lost */
+    if (_channel.collisions && (iface->receiving > 0) && (iface->rx_until > iface->collision_until)) {
+        iface->collision_until = iface->rx_until;
+    }
+
+    for (uint16_t i = 0; i < n->num_neighbors; i++) {
+        struct vn_link *link = &n->neighbors[i];
+        bool addressed = (pkt->next_hop == BROADCAST) || (pkt->next_hop == link->node);
+
+        if ((link->iface != f) || (!addressed && !_channel.collisions)) {
+            continue;
+        }
+
+        struct vn_packet *copy = malloc(sizeof(struct vn_packet));
+        if (copy) {
+            memcpy(copy, pkt, sizeof(struct vn_packet));
+            copy->lost = (link->loss > 0) && ((_random(node) % 1000) < link->loss);
+            if (_schedule(_now + link->latency, EVENT_RX_START, link->node, f, copy, node) < 0) {
+                free(copy);
+            }
+        }
+    }
+
+    if (_schedule(_now + pkt->airtime, EVENT_TX_DONE, node, f, NULL, node) < 0) {
+        iface->transmitting = NULL;
+        free(pkt);
+    }
+}
+
+static void _tx_done(uint16_t node, uint8_t f)
+{
+    struct vn_iface *iface = &_nodes[node].ifaces[f];
+
+    free(iface->transmitting);
+    iface->transmitting = NULL;
+
+    _start_tx(node, f);
+}
+
+/*
+ * The first bit of a frame arrives. If the radio is already receiving or
+ * sending, everything that is on the air at this receiver is garbled: all
+ * frames that end no later than collision_until are dropped when they end.
+ */
+static void _rx_start(uint16_t node, struct vn_packet *pkt)
+{
+    struct vn_iface *iface = &_nodes[node].ifaces[pkt->iface];
+
+    pkt->rx_end = _now + pkt->airtime;
+
+    if (_channel.collisions && ((iface->receiving > 0) || (iface->tx_until > _now))) {
+        uint64_t until = pkt->rx_end;
+        if ((iface->receiving > 0) && (iface->rx_until > until)) {
+            until = iface->rx_until;
+        }
+        if (until > iface->collision_until) {
+            iface->collision_until = until;
+        }
+    }
+
+    if ((iface->receiving == 0) || (pkt->rx_end > iface->rx_until)) {
+        iface->rx_until = pkt->rx_end;
+    }
+    iface->receiving++;
+
+    if (_schedule(pkt->rx_end, EVENT_RX_END, node, pkt->iface, pkt, node) < 0) {
+        iface->receiving--;
+        free(pkt);
+    }
+}
+
+static void _rx_end(uint16_t node, struct vn_packet *pkt)
+{
+    struct vn_iface *iface = &_nodes[node].ifaces[pkt->iface];
+    bool addressed = (pkt->next_hop == BROADCAST) || (pkt->next_hop == node);
+
+    iface->receiving--;
+
+    if (!addressed) {
+        free(pkt);
+    }
+    else if (_channel.collisions && (pkt->rx_end <= iface->collision_until)) {
+        iface->num_collisions++;
+        free(pkt);
+    }
+    else if (pkt->lost) {
+        iface->num_losses++;
+        free(pkt);
+    }
+    else {
+        _receive(node, pkt);
+    }
+}
+
+static uint32_t _airtime(uint16_t len)
+{
+    if (_channel.bitrate == 0) {
+        return VIRTUALNETWORK_FRAME_TIME;
+    }
+    uint64_t bits = (uint64_t) (len + _channel.overhead) * 8;
+    return (bits * 1000000 + _channel.bitrate - 1) / _channel.bitrate;
+}
+
+/* random number of backoff periods between 0 and 2^exponent - 1 */
+static uint32_t _backoff(uint16_t node, uint8_t exponent)
+{
+    return (_random(node) % (1 << exponent)) * VIRTUALNETWORK_UNIT_BACKOFF;
+}
+
+/* xorshift32 */
+static uint32_t _random(uint16_t node)
+{
+    uint32_t x = _nodes[node].rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    _nodes[node].rng = x;
+    return x;
+}
+
+static void _seed_nodes(void)
+{
+    for (uint16_t i = 0; i < _num_nodes; i++) {
+        /* xorshift must not start at 0 */
+        _nodes[i].rng = ((_seed * 2654435761u) ^ ((i + 1) * 0x9e3779b9u)) | 1;
+    }
+}
+
+/* a frame arrived at node: deliver it if it is meant for node, forward it otherwise */
+static void _receive(uint16_t node, struct vn_packet *pkt)
+{
+    struct vn_node *n = &_nodes[node];
+    uint16_t caller = _current;
+    ipv6_addr_t addr;
+
+    virtualnetwork_get_addr(node, &addr);
+    _current = node;
+
+    if ((pkt->dst.uint8[0] == 0xff) || (memcmp(&pkt->dst, &addr, sizeof(addr)) == 0)) {
+        _deliver(node, pkt);
+    }
+    else if (_route(node, pkt) < 0) {
+        DEBUG("[virtualnetwork] node %" PRIu16 ": no route, dropping packet\n", node);
+        n->no_route++;
+        free(pkt);
+    }
+    else {
+        _enqueue(node, pkt);
+    }
+
+    _current = caller;
+}
+
+/* put pkt into the inbox of node and let the receive handler know */
+static void _deliver(uint16_t node, struct vn_packet *pkt)
+{
+    struct vn_node *n = &_nodes[node];
+    uint16_t caller = _current;
+
+    if (n->inbox_count == VIRTUALNETWORK_INBOX_LEN) {
+        n->inbox_dropped++;
+        free(pkt);
+        return;
+    }
+
+    n->inbox[(n->inbox_head + n->inbox_count) % VIRTUALNETWORK_INBOX_LEN] = pkt;
+    n->inbox_count++;
+    if (_receive_handler) {
+        _current = node;
+        _receive_handler(node);
+        _current = caller;
+    }
+}
+
+/*
+ * Events for nodes of the calling thread's partition go straight into its
+ * heap. During a parallel run, events for other partitions are collected in
+ * an outbox that only this thread writes to. The owner of the target
+ * partition picks them up after the window, when no one writes anymore.
+ */
+static int _schedule(uint64_t time, enum vn_event_type type, uint16_t node, uint8_t iface,
+                     struct vn_packet *pkt, uint16_t origin)
+{
+    struct vn_event event = { time, origin, _nodes[origin].event_seq++, type, node, iface, pkt };
+    uint16_t target = _nodes[node].partition;
+
+    if (_parallel && (&_partitions[target] != _partition)) {
+        return _append(&_partition->outboxes[target], &event);
+    }
+    return _push_event(&_partitions[target].heap, &event);
+}
+
+static void _dispatch(struct vn_event *event)
+{
+    _now = event->time;
+
+    switch (event->type) {
+        case EVENT_CCA:
+            _cca(event->node, event->iface);
+            break;
+        case EVENT_TX_DONE:
+            _tx_done(event->node, event->iface);
+            break;
+        case EVENT_RX_START:
+            _rx_start(event->node, event->pkt);
+            break;
+        case EVENT_RX_END:
+            _rx_end(event->node, event->pkt);
+            break;
+        case EVENT_INJECT:
+            _deliver(event->node, event->pkt);
+            break;
+    }
+}
+
+/* process the events of all partitions in one thread, in global order */
+static uint32_t _run_sequential(void)
+{
+    uint32_t processed = 0;
+    struct vn_event event;
+
+    for (;;) {
+        struct vn_partition *next = NULL;
+
+        for (uint16_t p = 0; p < _num_partitions; p++) {
+            struct vn_events *heap = &_partitions[p].heap;
+            if ((heap->num_events > 0)
+                && (!next || _before(&heap->events[0], &next->heap.events[0]))) {
+                next = &_partitions[p];
+            }
+        }
+        if (!next || (next->heap.events[0].time > _run_end)) {
+            break;
+        }
+
+        _pop_event(&next->heap, &event);
+        _partition = next;
+        _dispatch(&event);
+        processed++;
+    }
+
+    _partition = NULL;
+    return processed;
+}
+
+/*
+ * Conservative synchronization: no event can affect a node of another
+ * partition sooner than _lookahead after it happened. So once the earliest
+ * pending event of all partitions is known, every partition can process its
+ * events up to that time + _lookahead without waiting for the others. The
+ * calling thread simulates partition 0.
+ */
+static uint32_t _run_parallel(void)
+{
+    pthread_t threads[_num_partitions];
+    uint32_t processed = 0;
+    uint16_t started = 1;
+
+    pthread_barrier_init(&_barrier, NULL, _num_partitions);
+    _parallel = true;
+    _stop = false;
+    _started = false;
+
+    for (uint16_t p = 0; p < _num_partitions; p++) {
+        _partitions[p].processed = 0;
+    }
+    for (; started < _num_partitions; started++) {
+        if (pthread_create(&threads[started], NULL, _worker, (void *)(uintptr_t) started) != 0) {
+            break;
+        }
+    }
+
+    /* workers only enter the barrier once all of them are there; if one
+     * couldn't be started, the others quit and the run continues in this thread */
+    pthread_mutex_lock(&_start_mutex);
+    _started = true;
+    _stop = (started < _num_partitions);
+    pthread_cond_broadcast(&_start_cond);
+    pthread_mutex_unlock(&_start_mutex);
+
+    if (!_stop) {
+        _run_partition(0);
+    }
+    else {
+        DEBUG("[virtualnetwork] couldn't start worker %" PRIu16 "\n", started);
+    }
+
+    for (uint16_t p = 1; p < started; p++) {
+        pthread_join(threads[p], NULL);
+    }
+    _parallel = false;
+    _partition = NULL;
+    pthread_barrier_destroy(&_barrier);
+
+    for (uint16_t p = 0; p < _num_partitions; p++) {
+        processed += _partitions[p].processed;
+    }
+    if (started < _num_partitions) {
+        processed += _run_sequential();
+    }
+    return processed;
+}
+
+static void *_worker(void *arg)
+{
+    pthread_mutex_lock(&_start_mutex);
+    while (!_started) {
+        pthread_cond_wait(&_start_cond, &_start_mutex);
+    }
+    bool stop = _stop;
+    pthread_mutex_unlock(&_start_mutex);
+
+    if (!stop) {
+        _run_partition((uint16_t)(uintptr_t) arg);
+    }
+    return NULL;
+}
+
+static void _run_partition(uint16_t p)
+{
+    struct vn_event event;
+    struct vn_events *heap = &_partitions[p].heap;
+
+    _partition = &_partitions[p];
+
+    for (;;) {
+        /* every partition has published its pending events */
+        pthread_barrier_wait(&_barrier);
+        if (p == 0) {
+            _next_window();
+        }
+        pthread_barrier_wait(&_barrier);
+        if (_stop) {
+            break;
+        }
+
+        while ((heap->num_events > 0) && (heap->events[0].time < _window_end)) {
+            _pop_event(heap, &event);
+            _dispatch(&event);
+            _partitions[p].processed++;
+        }
+
+        /* all outboxes are complete */
+        pthread_barrier_wait(&_barrier);
+        for (uint16_t q = 0; q < _num_partitions; q++) {
+            struct vn_events *outbox = &_partitions[q].outboxes[p];
+            for (uint32_t i = 0; i < outbox->num_events; i++) {
+                if (_push_event(heap, &outbox->events[i]) < 0) {
+                    free(outbox->events[i].pkt);
+                }
+            }
+            outbox->num_events = 0;
+        }
+    }
+}
+
+static void _next_window(void)
+{
+    struct vn_event *first = NULL;
+
+    for (uint16_t p = 0; p < _num_partitions; p++) {
+        struct vn_events *heap = &_partitions[p].heap;
+        if ((heap->num_events > 0) && (!first || (heap->events[0].time < first->time))) {
+            first = &heap->events[0];
+        }
+    }
+
+    if (!first || (first->time > _run_end)) {
+        _stop = true;
+        return;
+    }
+    _window_end = first->time + _lookahead;
+    if (_window_end > _run_end + 1) {
+        _window_end = _run_end + 1;
+    }
+}
+
+/* smallest latency of all links between partitions, UINT32_MAX if there are none */
+static uint32_t _get_lookahead(void)
+{
+    uint32_t lookahead = UINT32_MAX;
+
+    for (uint16_t i = 0; i < _num_nodes; i++) {
+        for (uint16_t j = 0; j < _nodes[i].num_neighbors; j++) {
+            struct vn_link *link = &_nodes[i].neighbors[j];
+            if ((_nodes[link->node].partition != _nodes[i].partition) && (link->latency < lookahead)) {
+                lookahead = link->latency;
+            }
+        }
+    }
+    return lookahead;
+}
+
+/* split the nodes into blocks of consecutive ids, one per thread. Topologies
+ * usually number neighboring nodes closely, so most links stay inside a
+ * partition. */
+static int _setup_partitions(void)
+{
+    _num_partitions = (_num_threads < _num_nodes) ? _num_threads : _num_nodes;
+    if (_num_partitions == 0) {
+        _num_partitions = 1;
+    }
+
+    _partitions = calloc(_num_partitions, sizeof(struct vn_partition));
+    if (!_partitions) {
+        _num_partitions = 0;
+        return -1;
+    }
+    for (uint16_t p = 0; p < _num_partitions; p++) {
+        _partitions[p].outboxes = calloc(_num_partitions, sizeof(struct vn_events));
+        if (!_partitions[p].outboxes) {
+            return -1;
+        }
+    }
+
+    for (uint16_t i = 0; i < _num_nodes; i++) {
+        _nodes[i].partition = (uint32_t) i * _num_partitions / _num_nodes;
+    }
+    return 0;
+}
+
+static void _free_partitions(void)
+{
+    for (uint16_t p = 0; p < _num_partitions; p++) {
+        struct vn_partition *partition = &_partitions[p];
+
+        for (uint32_t i = 0; i < partition->heap.num_events; i++) {
+            free(partition->heap.events[i].pkt);
+        }
+        free(partition->heap.events);
+
+        if (partition->outboxes) {
+            for (uint16_t q = 0; q < _num_partitions; q++) {
+                for (uint32_t i = 0; i < partition->outboxes[q].num_events; i++) {
+                    free(partition->outboxes[q].events[i].pkt);
+                }
+                free(partition->outboxes[q].events);
+            }
+            free(partition->outboxes);
+        }
+    }
+    free(_partitions);
+    _partitions = NULL;
+    _num_partitions = 0;
+}
+
+static bool _before(struct vn_event *a, struct vn_event *b)
+{
+    if (a->time != b->time) {
+        return a->time < b->time;
+    }
+    if (a->origin != b->origin) {
+        return a->origin < b->origin;
+    }
+    return a->seq < b->seq;
+}
+
+static int _append(struct vn_events *events, struct vn_event *event)
+{
+    if (events->num_events == events->max_events) {
+        uint32_t max = (events->max_events > 0) ? events->max_events * 2 : 64;
+        struct vn_event *e = realloc(events->events, max * sizeof(struct vn_event));
+        if (!e) {
+            return -1;
+        }
+        events->events = e;
+        events->max_events = max;
+    }
+    events->events[events->num_events++] = *event;
+    return 0;
+}
+
+static int _push_event(struct vn_events *heap, struct vn_event *event)
+{
+    if (_append(heap, event) < 0) {
+        return -1;
+    }
+
+    /* sift up */
+    uint32_t i = heap->num_events - 1;
+    struct vn_event e = *event;
+
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (_before(&heap->events[parent], &e)) {
+            break;
+        }
+        heap->events[i] = heap->events[parent];
+        i = parent;
+    }
+    heap->events[i] = e;
+    return 0;
+}
+
+static void _pop_event(struct vn_events *heap, struct vn_event *event)
+{
+    *event = heap->events[0];
+    struct vn_event last = heap->events[--heap->num_events];
+
+    /* sift down */
+    uint32_t i = 0;
+    while (2 * i + 1 < heap->num_events) {
+        uint32_t child = 2 * i + 1;
+        if ((child + 1 < heap->num_events)
+            && _before(&heap->events[child + 1], &heap->events[child])) {
+            child++;
+        }
+        if (_before(&last, &heap->events[child])) {
+            break;
+        }
+        heap->events[i] = heap->events[child];
+        i = child;
+    }
+    heap->events[i] = last;
 }
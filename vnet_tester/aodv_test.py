@@ -15,6 +15,8 @@ import os
 import sys
 import pprint
 import json
+import re
+import hashlib
 
 import topology_viz as tv
 
@@ -32,16 +34,27 @@ riots_lock = threading.Lock()
 riots_complete = threading.Lock()
 riots_ready = threading.Lock()
 potential_targnodes = {} # key: (i,j) coordinate on the Grid. value: [(i,j)] nodes that are far enough away
+edges = None # with --edges: key: node id. value: [node ids of its neighbors]
 num_ready_riots = num_riots = 0
 sockets = []
 sockets_lock = threading.Lock()
 ports_local_path = "../../riot/desvirt_mehlis/ports.list" # TODO properly
 max_shutdown_interval = shutdown_riots = shutdown_window = 0
-shutdown_queue = Queue.Queue()
+shutdown_nodes = set() # nodes the shutdown thread told to shut down
 msg_queues = {}
 
+# Everything random is drawn before any thread starts, so that the same seed
+# gives the same run however the threads are scheduled.
+seed = None
+schedules = {} # key: node. value: [(seconds to wait, [targnodes])] in the order they are sent
+shutdown_schedule = [] # [(seconds to wait, node)]
+
 plain_mode = False
 dont_send = False
+ratelimits = [] # shell commands that configure the RREQ/RERR rate limiter of each node
+local_repair = False
+targets_per_send = 1 # number of destinations each send_data(_multi) goes to
+backup_routes = False
 date = ""
 dir_name = ""
 
@@ -61,6 +74,11 @@ def get_ports():
         for port_string in ports_local:
             lst = port_string.split(",")
 
+            # with an edge list, nodes are known by their id ("<id>,<port>")
+            if (edges is not None and len(lst) is 3):
+                sys.stdout.write("%s has grid coordinates, but --edges was given. Exiting.\n" % ports_local_path)
+                sys.exit()
+
             # handle grid
             if (len(lst) is 3):
                 i = int(lst[0])
@@ -83,6 +101,44 @@ def get_ports():
                 if (i < i_min ): #positions are negative, warum auch immer
                     i_min = i
 
+'''
+read a topology written by topology_gen.py -f edges: "# nodes <n>" followed by
+one "<a> <b>" line per link
+'''
+def load_edges(path):
+    neighbors = {}
+    with open(path, 'r') as f:
+        for line in f:
+            match = re.match("# nodes (\d+)", line)
+            if (match):
+                for node in range(int(match.groups()[0])):
+                    neighbors.setdefault(node, [])
+                continue
+            fields = line.split()
+            if (line.startswith("#") or len(fields) < 2):
+                continue
+            (a, b) = (int(fields[0]), int(fields[1]))
+            for (x, y) in ((a, b), (b, a)):
+                if (y not in neighbors.setdefault(x, [])):
+                    neighbors[x].append(y)
+    return neighbors
+
+'''
+hop distances over the edge list from node to every node it can reach
+'''
+def hop_distances(node):
+    distances = {node: 0}
+    frontier = [node]
+    while (frontier):
+        next_frontier = []
+        for n in frontier:
+            for neighbor in edges.get(n, []):
+                if (neighbor not in distances):
+                    distances[neighbor] = distances[n] + 1
+                    next_frontier.append(neighbor)
+        frontier = next_frontier
+    return distances
+
 '''
 parse something like
 ifconfig
@@ -131,8 +187,13 @@ def collect_potential_targnodes():
     print "i_max:", i_max, "j_max:", j_max, "min_hop_distance:", min_hop_distance
 
     for position, connection in riots.iteritems():
+        # topology from an edge list: use the actual hop distances
+        if (edges is not None):
+            potential_targnodes[position] = [node for (node, distance) in hop_distances(position).iteritems()
+                                             if (distance >= min_hop_distance and node in riots)]
+
         # get positions on grid
-        if (type(position) is tuple):
+        elif (type(position) is tuple):
             i = position[0]
             j = position[1]
 
@@ -159,7 +220,10 @@ def collect_potential_targnodes():
 def collect_neighbor_coordinates(position, i_max, j_max):
     neighbor_coordinates = []
 
-    if (type(position) is tuple):
+    if (edges is not None):
+        neighbor_coordinates = [node for node in edges.get(position, []) if node in riots]
+
+    elif (type(position) is tuple):
         i = int(position[0])
         j = int(position[1])
 
@@ -184,7 +248,6 @@ def connect_riots():
 
     riots_complete.acquire()
     riots_ready.acquire()
-    collect_potential_targnodes()
 
     for position, connection in riots.iteritems():
         start_new_thread(test_sender_thread,(position,connection[0]))
@@ -204,11 +267,12 @@ def connect_riots():
         start_new_thread(test_shutdown_thread,())
 
     if (plain_mode):
+        rng = make_random("plain")
         while (not dont_send):
-            orignode = random.choice(riots.keys())
+            orignode = rng.choice(sorted(riots.keys()))
 
             if (len(potential_targnodes[orignode]) > 0):
-                targnode = random.choice(potential_targnodes[orignode])
+                targnode = rng.choice(sorted(potential_targnodes[orignode]))
                 targnode_ip = riots[targnode][1][0]
                 print "orignode:", orignode, "targnode:", targnode, "targnode_ip", targnode_ip
 
@@ -218,6 +282,60 @@ def connect_riots():
     # after experiment_duration, this function will exit and kill all the threads it generated.
     time.sleep(experiment_duration)
 
+'''
+generator that is only used by one thread (or for one purpose), so its draws
+don't depend on how the threads interleave. Unseeded without --seed.
+'''
+def make_random(name):
+    if (seed is None):
+        return random.Random()
+    # not hash(), which differs between 32 and 64 bit Pythons
+    return random.Random(int(hashlib.md5(repr((seed, name))).hexdigest(), 16))
+
+'''
+draw when each node sends to which targets, and when which node is shut
+down, for the whole experiment
+'''
+def make_schedules():
+    global schedules, shutdown_schedule
+
+    for position in sorted(riots.keys()):
+        rng = make_random(position)
+        my_targnodes = sorted(potential_targnodes[position])
+        schedule = []
+        elapsed = 0
+        while (elapsed < experiment_duration):
+            some_time = rng.randint(1, max_silence_interval)
+            elapsed += some_time
+            if (len(my_targnodes) == 0):
+                targnodes = []
+            elif (targets_per_send > 1):
+                targnodes = rng.sample(my_targnodes, min(targets_per_send, len(my_targnodes)))
+            else:
+                targnodes = [rng.choice(my_targnodes)]
+            schedule.append((some_time, targnodes))
+        schedules[position] = schedule
+
+    rng = make_random("shutdown")
+    alive = sorted(riots.keys())
+    shutdown_schedule = []
+    # only shut down RIOTs in the last 3rd of the experiment
+    some_time = shutdown_window * 2
+    for n in range(min(shutdown_riots, len(alive))):
+        node = rng.choice(alive)
+        alive.remove(node)
+        shutdown_schedule.append((some_time, node))
+        some_time = rng.randint(1, max_shutdown_interval)
+
+'''
+the schedules as JSON, to check that a seed always gives the same run
+'''
+def dump_schedules(path):
+    with open(path, 'w') as f:
+        json.dump({"send": dict((repr(position), schedule) for (position, schedule) in schedules.iteritems()),
+                   "shutdown": [(some_time, repr(node)) for (some_time, node) in shutdown_schedule]},
+                  f, indent=1, sort_keys=True)
+
 def set_up_logging(ip, position, port, thread_id):
     # logging -d, ignore
     if (not os.path.exists(dir_name)):
@@ -238,7 +356,7 @@ def set_up_logging(ip, position, port, thread_id):
     logging.getLogger('').addHandler(file_handler)
 
 def test_sender_thread(position, port):
-    global shutdown_queue, potential_targnodes, num_ready_riots, dont_send
+    global potential_targnodes, num_ready_riots, dont_send
 
     sys.stdout.write("Port: %s\n" % port)
 
@@ -264,13 +382,8 @@ def test_sender_thread(position, port):
             sys.stdout.write("Hickup while retrieving IPs. Exiting. Please try again.\n")
             sys.exit()
 
-        # get all of my potential TargNodes
-        my_targnodes = potential_targnodes[position]
-        has_targnodes = len(my_targnodes) > 0
-
-        '''
-        TODO FIXME: this will set dont_sent to true for ALL threads if one has len == 0....!!
-        '''
+        # when to send to whom, see make_schedules()
+        my_schedule = list(schedules[position])
 
         # get relevant IP address
         my_addrs = get_node_addrs(data)
@@ -307,6 +420,18 @@ def test_sender_thread(position, port):
             # make sure that went okay and empty shell output buffer
             logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
 
+        if (local_repair):
+            sock.sendall("local_repair on\n")
+            logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
+
+        if (backup_routes):
+            sock.sendall("backup_routes on\n")
+            logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
+
+        for ratelimit in ratelimits:
+            sock.sendall("ratelimit %s\n" % ratelimit)
+            logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
+
         num_ready_riots += 1
 
         if (num_ready_riots < num_riots):
@@ -323,19 +448,28 @@ def test_sender_thread(position, port):
                     # print last words. hack hack hackity hack
                     sock.sendall("my last words:\n")
                     logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
+                    sock.sendall("ratelimit\n")
+                    logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
+                    sock.sendall("fwd_stats\n")
+                    logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
+                    sock.sendall("rt_events\n")
+                    logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
                     sock.sendall(instruction)
                     time.sleep(max_silence_interval)
                 else:
                     sock.sendall(instruction)
                     logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
 
+            elif (not plain_mode and not my_schedule):
+                # the experiment is over, wait to be told to exit
+                time.sleep(1)
+
             elif (not plain_mode):
                 #wait for a little while
-                some_time = random.randint(1, max_silence_interval)
+                (some_time, targnodes) = my_schedule.pop(0)
                 time.sleep(some_time)
 
-                try:
-                    shutdown_queue.get(False) # we've been told to shut down
+                if (position in shutdown_nodes): # we've been told to shut down
                     logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
                     sys.stdout.write("{%s} shutting down\n" % thread_id)
 
@@ -349,17 +483,21 @@ def test_sender_thread(position, port):
                         sys.stdout.write("{%s} notifying neighbor %s of my death\n" % (thread_id, neighbor))
 
                     sys.exit()
-                    self.process.terminate() # TODO does this do the trick?
 
-                except:
+                else:
                     # no shutdown instruction, continue as usual
-                    # pick random node
                     with riots_lock:
                         # only attempt to send if potential targnodes exist
                         #sys.stdout.write("dont_send: %r\n" % dont_send)
-                        if (has_targnodes and not dont_send):
-                            #sys.stdout.write("foo")
-                            targnode = random.choice(my_targnodes)
+                        if (targnodes and not dont_send and targets_per_send > 1):
+                            targnode_ips = " ".join([riots[t][1][0] for t in targnodes])
+
+                            logging.debug("{%s: %s, %s} send_data_multi to %s %s\n" % (thread_id, my_ip, position, targnode_ips, targnodes))
+                            sock.sendall("send_data_multi %s\n" % targnode_ips)
+                            logging.debug("{%s: %s, %s}\n%s" % (thread_id, my_ip, position, get_shell_output(sock)))
+
+                        elif (targnodes and not dont_send):
+                            targnode = targnodes[0]
                             targnode_ip = riots[targnode][1][0]
 
                             logging.debug("{%s: %s, %s} send_data to %s %s\n" % (thread_id, my_ip, position, targnode_ip, targnode))
@@ -372,9 +510,6 @@ def test_sender_thread(position, port):
         sys.exit()
 
 def test_shutdown_thread():
-    global shutdown_riots
-    global shutdown_queue
-
     #wait until everybody is ready
     riots_complete.acquire()
     riots_complete.release()
@@ -383,18 +518,11 @@ def test_shutdown_thread():
     riots_ready.acquire()
     riots_ready.release()
 
-    time.sleep(shutdown_window * 2)
-
-    while (shutdown_riots > 0):
-        # TODO use msg_queues also
-        sys.stdout.write("shutting down random node\n")
-
-        shutdown_queue.put("foo") #doesn't matter what's in there, as long as it's *something*
-        shutdown_riots -= 1
-
-        # wait a little while
-        some_time = random.randint(1, max_shutdown_interval)
+    # the node shuts down the next time it wakes up
+    for (some_time, node) in shutdown_schedule:
         time.sleep(some_time)
+        sys.stdout.write("shutting down node %s\n" % (node,))
+        shutdown_nodes.add(node)
 
 # kill tcp connections on SIGINT
 def signal_handler(signal, frame):
@@ -423,7 +551,7 @@ def close_connections():
     sys.stdout.write("done\n")
 
 def main():
-    global shutdown_riots, max_silence_interval, experiment_duration, max_shutdown_interval, min_hop_distance, shutdown_window, dont_send, plain_mode, dir_name
+    global shutdown_riots, max_silence_interval, experiment_duration, max_shutdown_interval, min_hop_distance, shutdown_window, dont_send, plain_mode, dir_name, local_repair, backup_routes, targets_per_send, edges, seed
 
     timestamp = time.time()
     signal.signal(signal.SIGINT, signal_handler)
@@ -437,14 +565,28 @@ def main():
     parser.add_argument('-m','--min_hop_dist', type = int, help='minimum distance between originating and target node (in hops)')
     parser.add_argument('-p','--plain', action='store_true', help='Only start one transmission')
     parser.add_argument('-ds','--dontsend', action='store_true', help='Do not send anything, just set up the network')
+    parser.add_argument('-lr','--localrepair', action='store_true', help='let nodes repair broken routes locally before sending a RERR')
+    parser.add_argument('-b','--backuproutes', action='store_true', help='let nodes keep alternate next hops and fail over to them when a link breaks')
+    parser.add_argument('-mt','--multitarget', type = int, help='send each packet to n random targets at once, discovering their routes in parallel')
+    parser.add_argument('-r','--ratelimit', action='append', metavar='CLASS,RATE,BURST,DELAY',
+                        help='limit control messages of CLASS (rreq_orig, rerr) to RATE per second with bursts of BURST, queueing them for at most DELAY ms. May be given multiple times.')
+    parser.add_argument('--seed', type = int, help='seed the choice of senders, targets and shutdowns, so a run can be repeated with another build')
+    parser.add_argument('--logdir', type = str, default = "./logs", help='directory the logs of this run are written below (default: ./logs)')
+    parser.add_argument('--schedule', type = str, metavar='FILE', help='only write the senders, targets and shutdowns the seed gives to FILE (JSON) and exit, without connecting to any node')
+    parser.add_argument('-e','--edges', type = str, help='take neighbors and hop distances from this edge list (topology_gen.py -f edges) instead of the grid or line positions in ports.list, which must then be "<node id>,<port>"')
 
     args = parser.parse_args()
 
-    if (args.debug):
+    seed = args.seed
+
+    if (args.edges):
+        edges = load_edges(args.edges)
+
+    if (args.debug or args.schedule):
         print "ALL OUTPUT GENERATED WILL NOT BE STORED IN A LOGFILE.\n"
         logging.basicConfig(level=logging.DEBUG, format=log_format, datefmt='%d-%m-%Y_%H:%M:%S')
     else:
-        logdir_name = "./logs"
+        logdir_name = args.logdir
         if (not os.path.exists(logdir_name)):
             os.makedirs(logdir_name)
 
@@ -483,6 +625,19 @@ def main():
     if (args.plain):
         plain_mode = True
 
+    if (args.localrepair):
+        local_repair = True
+
+    if (args.backuproutes):
+        backup_routes = True
+
+    if (args.multitarget > 1):
+        targets_per_send = args.multitarget
+
+    if (args.ratelimit):
+        for ratelimit in args.ratelimit:
+            ratelimits.append(" ".join(ratelimit.split(",")))
+
     if (args.dontsend):
         dont_send = True
         experiment_duration = 1
@@ -490,6 +645,13 @@ def main():
     sys.stdout.write("Starting %i seconds of testing...\n" % experiment_duration)
 
     get_ports()
+    collect_potential_targnodes()
+    make_schedules()
+
+    if (args.schedule):
+        dump_schedules(args.schedule)
+        return
+
     connect_riots()
 
     if (not dont_send):
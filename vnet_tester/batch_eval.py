@@ -0,0 +1,286 @@
+'''
+Evaluate all runs in a logs/ tree at once.
+
+Every directory below the logs root that contains an aodv_test_<date>.log
+(as written by aodv_test.py) is a run. Runs are evaluated in parallel, one
+process each, in a single pass over their log: route discoveries are indexed
+by (orignode, targnode) and (orignode, targnode, seqnum) instead of being
+searched for every RREP, so a run is evaluated in time linear in its length.
+A node may discover routes to several targets at once (aodv_test.py -mt), so
+discoveries in progress are kept per (orignode, targnode) as well. RREQs the
+demo originates itself to refresh, repair or fail over a route are counted
+separately ("demo rreqs") and don't start discoveries.
+
+Results are cached in <logs root>/eval_cache.json, keyed by the path, size and
+modification time of the log, so only new or changed runs are evaluated again.
+The totals over all runs are handed to pretty_plots.plot_bars() like
+aodv_eval.py does for a single run.
+'''
+import argparse
+import json
+import multiprocessing
+import os
+import re
+import sys
+
+# bump whenever evaluate_run() changes what it counts, so cached results are dropped
+CACHE_VERSION = 3
+CACHE_FILE = "eval_cache.json"
+
+# a discovery that succeeded with fewer RREQs than this finished within its timeout
+DISCOVERY_ATTEMPTS_MAX = 3
+
+re_node_log_start = re.compile(".* {Dummy-.*: (.*), \(.*\)\}")
+re_next_hop = re.compile("\[aodvv2\] aodv_get_next_hop\(\) (.*): getting next hop for (.*)")
+re_rreq = re.compile("\[aodvv2\] originating RREQ with SeqNum (.*) towards (.*); updating RREQ table...")
+re_demo_rreq = re.compile("\[forwarding\] originating (\w+) RREQ with SeqNum (\d+) towards (.*), hop limit")
+re_found_dest = re.compile(".*found dest (.*) in routing table")
+re_rrep = re.compile(".* (.*):  This is my RREP \(SeqNum: (.*)\). We are done here, thanks (.*)!")
+re_sending = re.compile("{(\d+:\d+)}\[demo\]   sending packet of .* bytes towards (.*)...")
+re_received = re.compile(".*\[demo\].*UDP packet received from (.*):.*")
+re_sent = re.compile("{(\d+:\d+)}\[demo\]   Success sending Data: .* bytes sent to (.*)\.")
+
+def find_runs(logs_root):
+    runs = []
+    for (dir_path, dir_names, file_names) in os.walk(logs_root):
+        for file_name in file_names:
+            if (file_name.startswith("aodv_test_") and file_name.endswith(".log")):
+                runs.append(os.path.join(dir_path, file_name))
+    return sorted(runs)
+
+'''
+evaluate the log of one run. Counts the same things as
+aodv_eval.count_successes(), but keeps the discoveries in progress per
+(orignode, targnode) and joins RREPs to discoveries through dicts.
+'''
+def evaluate_run(log_file_location):
+    discoveries = []
+    by_nodes = {}           # (orignode, targnode) -> latest discovery
+    by_seqnum = {}          # (orignode, targnode, seqnum) -> discovery
+    curr_discovery = {}     # (orignode, targnode) -> discovery in progress
+    last_lookup = {}        # node -> (orignode, targnode) it last asked for a next hop
+    demo_rreqs = {}         # reason -> RREQs the demo originated itself
+    curr_ip = ""
+    num_transmissions = 0
+    num_received = 0
+    unmatched_rreps = 0
+    pending_sends = {}      # (orignode, targnode) -> time the packet was handed to the demo
+    send_latencies = []     # us until a route was found and the packet left
+
+    with open(log_file_location) as logfile:
+        for line in logfile:
+            match = re_node_log_start.search(line)
+            if (match):
+                curr_ip = match.groups()[0]
+                continue
+
+            if ("getting next hop for" in line):
+                match = re_next_hop.search(line)
+                if (match):
+                    key = match.groups()
+                    last_lookup[curr_ip] = key
+                    # a Route Discovery Retry doesn't start a new discovery
+                    if (key not in curr_discovery):
+                        curr_discovery[key] = {"orignode": key[0], "targnode": key[1],
+                                               "seqnums": [], "success": 0}
+
+            elif ("originating RREQ" in line):
+                match = re_rreq.search(line)
+                discovery = match and curr_discovery.get((curr_ip, match.groups()[1]))
+                if (discovery):
+                    seqnum = match.groups()[0]
+                    discovery["seqnums"].append(seqnum)
+                    by_seqnum[(discovery["orignode"], discovery["targnode"], seqnum)] = discovery
+                    # first RREQ of this discovery
+                    if (len(discovery["seqnums"]) == 1):
+                        discoveries.append(discovery)
+                        by_nodes[(discovery["orignode"], discovery["targnode"])] = discovery
+
+            # refresh, local repair and failover RREQs of forwarding.c. Their
+            # RREPs are joined to a discovery that isn't counted.
+            elif ("[forwarding] originating" in line):
+                match = re_demo_rreq.search(line)
+                if (match):
+                    (reason, seqnum, targnode) = match.groups()
+                    demo_rreqs[reason] = demo_rreqs.get(reason, 0) + 1
+                    by_seqnum[(curr_ip, targnode, seqnum)] = {"orignode": curr_ip, "targnode": targnode,
+                                                              "seqnums": [seqnum], "success": 0}
+
+            # requested route is direct neighbor
+            elif ("[ndp] found NC entry. Returning dest addr." in line):
+                discovery = curr_discovery.get(last_lookup.get(curr_ip))
+                if (discovery):
+                    discovery["success"] = 1
+
+            # the route was known before the discovery even started
+            elif ("found dest " in line):
+                match = re_found_dest.search(line)
+                discovery = match and curr_discovery.get((curr_ip, match.groups()[0]))
+                if (discovery and discovery["seqnums"] == []):
+                    discovery["success"] = 1
+
+            elif ("This is my RREP" in line):
+                match = re_rrep.search(line)
+                if (match):
+                    (orignode, seqnum, targnode) = match.groups()
+                    discovery = by_seqnum.get((orignode, targnode, seqnum)) or by_nodes.get((orignode, targnode))
+                    if (discovery):
+                        discovery["success"] = 1
+                    else:
+                        unmatched_rreps += 1
+
+            if ("[demo]   sending packet" in line):
+                match = re_sending.search(line)
+                if (match):
+                    num_transmissions += 1
+                    pending_sends[(curr_ip, match.groups()[1])] = _riot_time(match.groups()[0])
+                    # a new packet to the same target starts a new discovery
+                    curr_discovery.pop((curr_ip, match.groups()[1]), None)
+
+            elif ("[demo]   Success sending Data" in line):
+                match = re_sent.search(line)
+                if (match):
+                    sent = pending_sends.pop((curr_ip, match.groups()[1]), None)
+                    if (sent is not None):
+                        send_latencies.append(_riot_time(match.groups()[0]) - sent)
+
+            # the sender is the previous hop, not the originator, so received
+            # packets can't be joined to transmissions. count them instead.
+            elif ("[demo]   UDP packet received" in line):
+                num_received += 1
+
+    num_success = sum(d["success"] for d in discoveries)
+    within_timeout = sum(1 for d in discoveries
+                         if d["success"] and len(d["seqnums"]) < DISCOVERY_ATTEMPTS_MAX)
+    num_received = min(num_received, num_transmissions)
+    send_latencies.sort()
+
+    return {"discoveries": {"success": num_success, "fail": len(discoveries) - num_success},
+            "transmissions": {"success": num_received, "fail": num_transmissions - num_received},
+            "discoveries within timeout": within_timeout,
+            "rreqs": sum(len(d["seqnums"]) for d in discoveries),
+            "demo rreqs": demo_rreqs,
+            "unmatched rreps": unmatched_rreps,
+            "send latency": {"count": len(send_latencies),
+                             "mean": sum(send_latencies) / max(len(send_latencies), 1),
+                             "p90": send_latencies[len(send_latencies) * 9 / 10] if send_latencies else 0},
+            "rrep_fail": 0}
+
+# "<seconds>:<microseconds>" as printed by the demo
+def _riot_time(timestamp):
+    (seconds, microseconds) = timestamp.split(":")
+    return int(seconds) * 1000000 + int(microseconds)
+
+def _run_key(log_file_location):
+    stat = os.stat(log_file_location)
+    return "%s:%i:%i" % (os.path.abspath(log_file_location), stat.st_size, int(stat.st_mtime))
+
+def load_cache(cache_location):
+    try:
+        with open(cache_location) as cache_file:
+            cache = json.load(cache_file)
+    except (IOError, ValueError):
+        return {}
+    if (cache.get("version") != CACHE_VERSION):
+        return {}
+    return cache["runs"]
+
+def store_cache(cache_location, runs):
+    # write next to the cache and rename, so an interrupted run can't corrupt it
+    tmp_location = cache_location + ".tmp"
+    with open(tmp_location, "w") as cache_file:
+        json.dump({"version": CACHE_VERSION, "runs": runs}, cache_file, indent=1, sort_keys=True)
+    os.rename(tmp_location, cache_location)
+
+'''
+evaluate all runs below logs_root that aren't cached yet.
+returns {log file: results}
+'''
+def evaluate_runs(logs_root, jobs=None, use_cache=True):
+    cache_location = os.path.join(logs_root, CACHE_FILE)
+    cache = load_cache(cache_location) if use_cache else {}
+
+    runs = find_runs(logs_root)
+    keys = dict((run, _run_key(run)) for run in runs)
+    new_runs = [run for run in runs if keys[run] not in cache]
+
+    sys.stderr.write("%i runs, %i cached, evaluating %i\n" % (len(runs), len(runs) - len(new_runs), len(new_runs)))
+    if (new_runs):
+        if (jobs == 1 or len(new_runs) == 1):
+            new_results = map(evaluate_run, new_runs)
+        else:
+            pool = multiprocessing.Pool(jobs)
+            try:
+                new_results = pool.map(evaluate_run, new_runs)
+            finally:
+                pool.close()
+                pool.join()
+        for (run, results) in zip(new_runs, new_results):
+            cache[keys[run]] = results
+
+    # forget runs whose logs changed or were removed
+    cache = dict((keys[run], cache[keys[run]]) for run in runs)
+    if (use_cache):
+        store_cache(cache_location, cache)
+
+    return dict((run, cache[keys[run]]) for run in runs)
+
+def sum_results(results):
+    total = {"discoveries": {"success": 0, "fail": 0}, "transmissions": {"success": 0, "fail": 0},
+             "discoveries within timeout": 0, "rreqs": 0, "demo rreqs": {}, "unmatched rreps": 0, "rrep_fail": 0}
+    for run in results.values():
+        for kind in ("discoveries", "transmissions"):
+            for outcome in ("success", "fail"):
+                total[kind][outcome] += run[kind][outcome]
+        for (reason, count) in run["demo rreqs"].items():
+            total["demo rreqs"][reason] = total["demo rreqs"].get(reason, 0) + count
+        for key in ("discoveries within timeout", "rreqs", "unmatched rreps", "rrep_fail"):
+            total[key] += run[key]
+    return total
+
+def print_results(results):
+    print "%-60s %12s %12s %8s %10s" % ("run", "discoveries", "transmitted", "RREQs", "demo RREQs")
+    for run in sorted(results):
+        r = results[run]
+        print "%-60s %5i/%-6i %5i/%-6i %8i %10i" % (os.path.relpath(run), r["discoveries"]["success"],
+              r["discoveries"]["success"] + r["discoveries"]["fail"], r["transmissions"]["success"],
+              r["transmissions"]["success"] + r["transmissions"]["fail"], r["rreqs"], sum(r["demo rreqs"].values()))
+
+'''
+same bars as aodv_eval.handle_logfile(), for the totals of many runs
+'''
+def plot_results(total):
+    import pretty_plots as pp
+
+    successes = ((total["discoveries within timeout"], 0),
+                 (total["discoveries"]["success"] - total["discoveries within timeout"], total["transmissions"]["success"]))
+    failures = ((total["rrep_fail"], 0),
+                (total["discoveries"]["fail"] - total["rrep_fail"], total["transmissions"]["fail"]))
+    pp.plot_bars(("successful", "failed"), ("Route Discoveries", "Transmissions"), successes, failures)
+
+def main():
+    parser = argparse.ArgumentParser(description='evaluate all aodv_test runs in a logs directory')
+    parser.add_argument('logs', nargs='?', default="./logs", help='logs directory (default: ./logs)')
+    parser.add_argument('-j','--jobs', type=int, help='number of runs evaluated in parallel (default: number of CPUs)')
+    parser.add_argument('--no-cache', action='store_true', help='evaluate all runs again and leave the cache alone')
+    parser.add_argument('--no-plot', action='store_true', help='only print the results')
+
+    args = parser.parse_args()
+    if (not os.path.isdir(args.logs)):
+        print "Couldn't find logs directory. Aborting."
+        return
+
+    results = evaluate_runs(args.logs, args.jobs, not args.no_cache)
+    if (not results):
+        print "no runs found."
+        return
+
+    print_results(results)
+    total = sum_results(results)
+    print "total: ", total
+
+    if (not args.no_plot):
+        plot_results(total)
+
+if __name__ == "__main__":
+    main()
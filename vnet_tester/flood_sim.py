@@ -0,0 +1,262 @@
+'''
+Estimate what RREQ flooding optimizations buy us on the topologies aodv_test.py
+builds, before touching the aodvv2 reader.
+
+Every node keeps an RREQ table with the same redundancy rules as
+rreqtable_is_redundant(): an RREQ is redundant unless it carries a newer SeqNum
+than the last one seen for its OrigNode and TargNode, or the same SeqNum with a
+better metric (there is only one metric type here). Redundant RREQs are never
+forwarded. Non-redundant ones are handed to the selected forwarding policy:
+
+plain    forward every non-redundant RREQ (what aodvv2 does today)
+gossip   GOSSIP1(p, k): forward with probability p, always within the first k hops
+counter  wait a random assessment delay, forward only if fewer than c copies
+         of the RREQ were heard meanwhile
+coverage forward only if the node has neighbors that the sender doesn't cover
+
+For each policy, the same random OrigNode/TargNode pairs are flooded and we
+report the delivery ratio (RREQ reached TargNode), the number of RREQ
+transmissions per discovery and the length of the discovered route compared
+to the shortest path.
+
+With -t n, every OrigNode discovers n TargNodes at once, and each policy is
+also run in batched mode: a single RREQ carries all n TargNodes. Intermediate
+nodes check redundancy for every TargNode of the RREQ and forward it with the
+TargNodes for which it wasn't redundant, if any. Every TargNode answers for
+itself and keeps forwarding the RREQ for the other TargNodes.
+'''
+import argparse
+import heapq
+import random
+
+RREQ_HOP_DELAY = (0.005, 0.015) # seconds, uniformly distributed per transmission
+COUNTER_RAD = 0.02              # max random assessment delay of the counter policy
+
+'''
+same neighborhood as collect_neighbor_coordinates() in aodv_test.py: every node
+is connected to the (up to) 8 nodes surrounding it on the grid
+'''
+def grid_topology(i_max, j_max):
+    neighbors = {}
+    for i in range(1, i_max+1):
+        for j in range(1, j_max+1):
+            neighbors[(i,j)] = set([(m,n) for m in range(i-1, i+2) for n in range(j-1, j+2)
+                                    if (1 <= m <= i_max) and (1 <= n <= j_max) and (m,n) != (i,j)])
+    return neighbors
+
+def line_topology(length):
+    neighbors = {}
+    for i in range(1, length+1):
+        neighbors[i] = set([m for m in (i-1, i+1) if (1 <= m <= length)])
+    return neighbors
+
+def hop_distances(neighbors, source):
+    distances = {source: 0}
+    frontier = [source]
+    while (frontier):
+        next_frontier = []
+        for node in frontier:
+            for neighbor in neighbors[node]:
+                if (neighbor not in distances):
+                    distances[neighbor] = distances[node] + 1
+                    next_frontier.append(neighbor)
+        frontier = next_frontier
+    return distances
+
+class RreqTable:
+    def __init__(self):
+        self.entries = {} # (orignode, targnode): (seqnum, metric)
+
+    # mirrors rreqtable_is_redundant() (without seqnum wraparound and expiry)
+    def is_redundant(self, orignode, targnode, seqnum, metric):
+        entry = self.entries.get((orignode, targnode))
+        if (entry is None or seqnum > entry[0] or (seqnum == entry[0] and metric < entry[1])):
+            self.entries[(orignode, targnode)] = (seqnum, metric)
+            return False
+        return True
+
+    # the TargNodes of an RREQ for which it isn't redundant
+    def fresh_targets(self, orignode, targnodes, seqnum, metric):
+        return frozenset(t for t in targnodes if not self.is_redundant(orignode, t, seqnum, metric))
+
+class Flood:
+    def __init__(self, neighbors, policy, params, loss, rng):
+        self.neighbors = neighbors
+        self.policy = policy
+        self.params = params
+        self.loss = loss
+        self.rng = rng
+        self.rreq_tables = dict((node, RreqTable()) for node in neighbors)
+
+    '''
+    flood one RREQ from orignode towards all targnodes. returns (number of
+    transmissions, {targnode: metric with which the RREQ first reached it})
+    '''
+    def run(self, orignode, targnodes, seqnum):
+        events = []   # (time, counter, kind, node, metric, sender, targets)
+        counter = [0]
+        transmissions = [0]
+        heard = {}    # node: number of copies heard (counter policy)
+        pending = {}  # node: TargNodes to forward once the assessment delay is over
+        reached = {}
+
+        def schedule(time, kind, node, metric, sender, targets):
+            counter[0] += 1
+            heapq.heappush(events, (time, counter[0], kind, node, metric, sender, targets))
+
+        def transmit(time, node, metric, targets):
+            transmissions[0] += 1
+            for neighbor in self.neighbors[node]:
+                if (self.rng.random() >= self.loss):
+                    schedule(time + self.rng.uniform(*RREQ_HOP_DELAY), "rx", neighbor, metric + 1, node, targets)
+
+        targets = self.rreq_tables[orignode].fresh_targets(orignode, targnodes, seqnum, 0)
+        transmit(0.0, orignode, 0, targets)
+
+        while (events):
+            (time, _, kind, node, metric, sender, targets) = heapq.heappop(events)
+
+            if (kind == "assess"):
+                targets = pending.pop(node)
+                if (heard.get(node, 0) < self.params["c"]):
+                    # forward the best copy that arrived in the meantime
+                    entries = self.rreq_tables[node].entries
+                    transmit(time, node, min(entries[(orignode, t)][1] for t in targets), targets)
+                continue
+
+            heard[node] = heard.get(node, 0) + 1
+            targets = self.rreq_tables[node].fresh_targets(orignode, targets, seqnum, metric)
+            if (not targets):
+                continue
+
+            if (node in targets):
+                if (node not in reached):
+                    reached[node] = metric
+                # a TargNode only keeps the RREQ going for the others
+                targets = targets - set([node])
+                if (not targets):
+                    continue
+
+            if (self.policy == "plain"):
+                transmit(time, node, metric, targets)
+
+            elif (self.policy == "gossip"):
+                if (metric <= self.params["k"] or self.rng.random() < self.params["p"]):
+                    transmit(time, node, metric, targets)
+
+            elif (self.policy == "counter"):
+                # a better copy during the assessment delay doesn't start a second one
+                if (node not in pending):
+                    pending[node] = targets
+                    schedule(time + self.rng.uniform(0, COUNTER_RAD), "assess", node, metric, sender, None)
+                else:
+                    pending[node] = pending[node] | targets
+
+            elif (self.policy == "coverage"):
+                uncovered = self.neighbors[node] - self.neighbors[sender] - set([sender])
+                if (uncovered):
+                    transmit(time, node, metric, targets)
+
+        return (transmissions[0], reached)
+
+'''
+pick num_groups OrigNodes with num_targets TargNodes each, all of them at least
+min_hop_distance hops away. returns [(orignode, {targnode: shortest distance})]
+'''
+def pick_groups(neighbors, num_groups, num_targets, min_hop_distance, rng):
+    nodes = sorted(neighbors.keys())
+    groups = []
+    for _ in range(num_groups * 100):
+        if (len(groups) == num_groups):
+            break
+        orignode = rng.choice(nodes)
+        distances = hop_distances(neighbors, orignode)
+        candidates = [n for n in nodes if distances.get(n, -1) >= min_hop_distance]
+        if (len(candidates) >= num_targets):
+            if (num_targets == 1):
+                targnodes = [rng.choice(candidates)]
+            else:
+                targnodes = rng.sample(candidates, num_targets)
+            groups.append((orignode, dict((t, distances[t]) for t in targnodes)))
+    return groups
+
+def evaluate(neighbors, policy, params, groups, batched, loss, seed):
+    rng = random.Random(seed)
+    flood = Flood(neighbors, policy, params, loss, rng)
+    delivered = transmissions = discoveries = floods = seqnum = 0
+    stretch = 0.0
+
+    for (orignode, targnodes) in groups:
+        if (batched):
+            batches = [targnodes.keys()]
+        else:
+            batches = [[t] for t in targnodes.keys()]
+
+        for batch in batches:
+            seqnum += 1
+            floods += 1
+            (num_tx, reached) = flood.run(orignode, set(batch), seqnum)
+            transmissions += num_tx
+            for (targnode, metric) in reached.iteritems():
+                delivered += 1
+                stretch += float(metric) / targnodes[targnode]
+        discoveries += len(targnodes)
+
+    return {"delivery": float(delivered) / discoveries,
+            "transmissions": float(transmissions) / discoveries,
+            "floods": floods,
+            "stretch": (stretch / delivered) if delivered else 0.0}
+
+def main():
+    parser = argparse.ArgumentParser(description='compare RREQ flooding optimizations against plain flooding')
+    parser.add_argument('-g','--grid', type=str, default="8x8", help='grid topology IxJ (default: 8x8)')
+    parser.add_argument('-l','--line', type=int, help='line topology of n nodes instead of a grid')
+    parser.add_argument('-n','--discoveries', type=int, default=200, help='number of route discoveries per policy')
+    parser.add_argument('-m','--min_hop_dist', type=int, default=3, help='minimum distance between OrigNode and TargNode (in hops)')
+    parser.add_argument('--loss', type=float, default=0.0, help='probability that a single link drops an RREQ')
+    parser.add_argument('-p','--gossip_p', type=float, default=0.65, help='forwarding probability of the gossip policy')
+    parser.add_argument('-k','--gossip_k', type=int, default=1, help='hops within which gossip always forwards')
+    parser.add_argument('-c','--counter', type=int, default=3, help='copy threshold of the counter policy')
+    parser.add_argument('-t','--targets', type=int, default=1, help='TargNodes discovered by each OrigNode at once')
+    parser.add_argument('-s','--seed', type=int, default=1, help='random seed')
+
+    args = parser.parse_args()
+
+    if (args.line):
+        neighbors = line_topology(args.line)
+        topology = "line of %i nodes" % args.line
+    else:
+        (i_max, j_max) = [int(x) for x in args.grid.split("x")]
+        neighbors = grid_topology(i_max, j_max)
+        topology = "%ix%i grid" % (i_max, j_max)
+
+    num_groups = max(1, args.discoveries / args.targets)
+    groups = pick_groups(neighbors, num_groups, args.targets, args.min_hop_dist, random.Random(args.seed))
+    if (not groups):
+        print "no node has %i nodes %i hops away in a %s" % (args.targets, args.min_hop_dist, topology)
+        return
+
+    params = {"p": args.gossip_p, "k": args.gossip_k, "c": args.counter}
+    policies = [("plain", "plain"),
+                ("gossip", "gossip(p=%.2f,k=%i)" % (args.gossip_p, args.gossip_k)),
+                ("counter", "counter(c=%i)" % args.counter),
+                ("coverage", "coverage")]
+    modes = [False, True] if (args.targets > 1) else [False]
+
+    print "%s, %i discoveries, link loss %.2f\n" % (topology, len(groups) * args.targets, args.loss)
+    print "%-26s %10s %8s %14s %10s %10s" % ("policy", "delivery", "floods", "RREQ tx/disc", "overhead", "stretch")
+
+    baseline = None
+    for (policy, label) in policies:
+        for batched in modes:
+            result = evaluate(neighbors, policy, params, groups, batched, args.loss, args.seed)
+            if (baseline is None):
+                baseline = result
+            overhead = result["transmissions"] / baseline["transmissions"] * 100
+            if (batched):
+                label += "+batch"
+            print "%-26s %9.1f%% %8i %14.1f %9.1f%% %10.2f" % (label, result["delivery"] * 100, result["floods"],
+                                                               result["transmissions"], overhead, result["stretch"])
+
+if __name__ == "__main__":
+    main()
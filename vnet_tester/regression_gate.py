@@ -0,0 +1,347 @@
+'''
+Compare a baseline and a candidate build of the aodvv2 module on identical
+scenarios and fail if the candidate performs worse.
+
+Both builds are made from the same aodvv2_demo and tests applications, each
+against its own RIOT tree (e.g. two git worktrees of RIOT). Every scenario is
+a seed: it picks the topology (topology_gen.py) and the senders, targets and
+shutdowns (aodv_test.py --seed), and both builds run it in turn, alternating
+which one goes first. aodv_test.py draws all of these before it starts its
+threads; before every run it is asked for them twice (--schedule), and the
+gate stops if they differ between the two, or between the builds. aodv_test.py gets the edge list of the topology
+(--edges), since the nodes of a generated desvirt net have no grid positions.
+Per run, batch_eval.py extracts
+
+discovery latency   time from handing a packet to the demo until it could be
+                    sent, i.e. until a route was found (ms)
+discovery success   share of route discoveries that found a route
+delivery ratio      share of sent packets that arrived
+RREQs per packet    RREQs originated per packet sent (including the ones
+                    forwarding.c sends), the control overhead
+
+and the tests application is run with BENCH=1 to get the RFC 5444 writer and
+reader throughput (see tests/bench_rfc5444.h). It is a RIOT native binary, so
+it needs a tap interface (--bench-tap) and doesn't exit by itself: it is
+stopped once it prints "[bench] done", or after --bench-timeout.
+
+Runs of the same seed are compared in pairs. For every metric the mean change
+is reported with a 95% confidence interval (Student's t over the paired
+differences). A metric regresses if it got worse by more than the threshold
+and the interval doesn't include "no change"; any regression makes the gate
+exit with 1. With fewer than 2 pairs there is no interval, and the metric is
+reported as inconclusive instead. Discovery latency grows in steps of
+RREQ_WAIT_TIME (2 s) whenever a discovery needs another RREQ, so changes
+smaller than --min-latency-change don't count as regression either.
+
+All samples are written to <out>/results.json; --results compares such a file
+again, e.g. with another threshold, without running anything.
+'''
+import argparse
+import json
+import math
+import os
+import re
+import signal
+import subprocess
+import sys
+import threading
+import time
+
+import batch_eval
+
+# 97.5% quantiles of Student's t distribution by degrees of freedom, for two-sided 95% intervals
+T_975 = {1: 12.706, 2: 4.303, 3: 3.182, 4: 2.776, 5: 2.571, 6: 2.447, 7: 2.365, 8: 2.306,
+         9: 2.262, 10: 2.228, 12: 2.179, 15: 2.131, 20: 2.086, 25: 2.060, 30: 2.042}
+
+VARIANTS = ("baseline", "candidate")
+
+# a metric needs this many paired samples to have a confidence interval
+MIN_PAIRS = 2
+
+# see RREQ_WAIT_TIME in aodvv2_demo/main.c
+RREQ_WAIT_TIME_MS = 2000
+
+BENCH_DONE = "[bench] done"
+
+script_dir = os.path.dirname(os.path.abspath(__file__))
+repo_dir = os.path.dirname(script_dir)
+
+re_bench = re.compile("\[bench\]  (\w+(?: \(round 1\))?) (\w+): .* (\d+) msgs/s, (\d+) bytes/s(?:, (\d+) allocs, (\d+) bytes allocated)?")
+
+def _ratio(counts):
+    total = counts["success"] + counts["fail"]
+    return float(counts["success"]) / total if total else None
+
+def _discovery_latency(results):
+    latency = results["send latency"]
+    return latency["mean"] / 1000.0 if latency["count"] else None
+
+def _rreqs_per_packet(results):
+    sent = results["transmissions"]["success"] + results["transmissions"]["fail"]
+    rreqs = results["rreqs"] + sum(results["demo rreqs"].values())
+    return float(rreqs) / sent if sent else None
+
+# name, True if higher is better, value from the batch_eval results of a run
+RUN_METRICS = [
+    ("discovery latency (ms)", False, _discovery_latency),
+    ("discovery success", True, lambda results: _ratio(results["discoveries"])),
+    ("delivery ratio", True, lambda results: _ratio(results["transmissions"])),
+    ("RREQs per packet", False, _rreqs_per_packet),
+]
+
+def t_975(df):
+    if (df > max(T_975)):
+        return 1.96
+    return T_975[max(k for k in T_975 if k <= df)]
+
+def build(variant, riot_dir, out_dir):
+    elfs = {}
+    for (app, extra_args, elf_name) in (("aodvv2_demo", [], "aodvv2_demo.elf"),
+                                        ("tests", ["BENCH=1"], "aodvv2_test.elf")):
+        bin_dir = os.path.join(out_dir, variant, "bin", app)
+        print "building %s %s against %s..." % (variant, app, riot_dir)
+        subprocess.check_call(["make", "-C", os.path.join(repo_dir, app), "all",
+                               "RIOTBASE=%s" % os.path.abspath(riot_dir),
+                               "BINDIRBASE=%s" % bin_dir] + extra_args)
+        elfs[app] = os.path.join(bin_dir, "native", elf_name)
+    return elfs
+
+def run_scenario(variant, elf, seed, args):
+    run_dir = os.path.join(args.out, variant, "seed_%i" % seed)
+    topology = os.path.join(run_dir, "topology.xml")
+    edges = os.path.join(run_dir, "topology.edges")
+    if (not os.path.exists(run_dir)):
+        os.makedirs(run_dir)
+
+    subprocess.check_call([sys.executable, os.path.join(script_dir, "topology_gen.py")]
+                          + args.topology.split() + ["-s", str(seed), "-f", "desvirt",
+                          "--name", args.net_name, "--binary", os.path.abspath(elf), "-o", topology,
+                          "--edges-output", edges])
+
+    commands = {"desvirt": os.path.abspath(args.desvirt), "name": args.net_name, "topology": topology}
+    subprocess.check_call(args.net_start.format(**commands), shell=True)
+    try:
+        time.sleep(args.boot_time)
+        schedule = dry_run(run_dir, edges, seed, args)
+        # aodv_test.py finds the ports of the nodes relative to its own directory
+        subprocess.check_call([sys.executable, "aodv_test.py", "-t", str(args.time), "--seed", str(seed),
+                               "--logdir", os.path.abspath(run_dir), "--edges", os.path.abspath(edges)]
+                              + args.test_args.split(), cwd=script_dir)
+    finally:
+        subprocess.call(args.net_stop.format(**commands), shell=True)
+
+    return (batch_eval.evaluate_run(batch_eval.find_runs(run_dir)[-1]), schedule)
+
+'''
+the senders, targets and shutdowns aodv_test.py draws for a seed. Runs are
+only comparable in pairs if these don't depend on anything but the seed, so
+they are drawn twice and have to match.
+'''
+def dry_run(run_dir, edges, seed, args):
+    schedules = []
+    for n in range(2):
+        path = os.path.join(run_dir, "schedule_%i.json" % n)
+        subprocess.check_call([sys.executable, "aodv_test.py", "-t", str(args.time), "--seed", str(seed),
+                               "--edges", os.path.abspath(edges), "--schedule", os.path.abspath(path)]
+                              + args.test_args.split(), cwd=script_dir)
+        with open(path) as schedule_file:
+            schedules.append(json.load(schedule_file))
+    if (schedules[0] != schedules[1]):
+        raise RuntimeError("seed %i gave two different schedules, see %s" % (seed, run_dir))
+    return schedules[0]
+
+def run_bench(variant, elf, args):
+    bench_dir = os.path.join(args.out, variant, "bench")
+    # the tests write the packets they build to the working directory
+    if (not os.path.exists(bench_dir)):
+        os.makedirs(bench_dir)
+
+    # in its own process group, so that nothing it started keeps the pipe open
+    proc = subprocess.Popen([os.path.abspath(elf), args.bench_tap], cwd=bench_dir, preexec_fn=os.setsid,
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    kill = lambda: os.killpg(proc.pid, signal.SIGKILL)
+    timer = threading.Timer(args.bench_timeout, kill)
+    timer.start()
+    lines = []
+    try:
+        for line in iter(proc.stdout.readline, ""):
+            lines.append(line)
+            if (BENCH_DONE in line):
+                break
+    finally:
+        timer.cancel()
+        try:
+            kill()
+        except OSError:
+            pass
+        proc.wait()
+
+    if (not any(BENCH_DONE in line for line in lines)):
+        print "benchmark of %s didn't finish within %i s, its results are incomplete" % (variant, args.bench_timeout)
+
+    samples = {}
+    for line in lines:
+        match = re_bench.search(line)
+        if (not match):
+            continue
+        (direction, mix, msgs, _, _, alloc_bytes) = match.groups()
+        samples["%s %s (msgs/s)" % (direction, mix)] = (True, float(msgs))
+        if (alloc_bytes is not None):
+            samples["%s %s (bytes allocated)" % (direction, mix)] = (False, float(alloc_bytes))
+    return samples
+
+'''
+run everything and return {metric: {"higher_is_better": bool, "baseline": [], "candidate": []}}.
+samples at the same index belong to the same seed or benchmark round.
+'''
+def collect(args):
+    elfs = {}
+    for (variant, riot_dir) in zip(VARIANTS, (args.baseline, args.candidate)):
+        elfs[variant] = build(variant, riot_dir, args.out)
+
+    metrics = {}
+    def add_sample(name, higher_is_better, variant, index, value):
+        metric = metrics.setdefault(name, {"higher_is_better": higher_is_better,
+                                           "baseline": [], "candidate": []})
+        samples = metric[variant]
+        samples.extend([None] * (index + 1 - len(samples)))
+        samples[index] = value
+
+    for (index, seed) in enumerate(args.seeds):
+        # alternate the order so slow drift of the host doesn't favor one build
+        order = VARIANTS if (index % 2 == 0) else tuple(reversed(VARIANTS))
+        schedules = []
+        for variant in order:
+            print "scenario %i: %s..." % (seed, variant)
+            (results, schedule) = run_scenario(variant, elfs[variant]["aodvv2_demo"], seed, args)
+            schedules.append(schedule)
+            if (schedule != schedules[0]):
+                raise RuntimeError("seed %i gave the baseline and the candidate different schedules" % seed)
+            for (name, higher_is_better, value) in RUN_METRICS:
+                add_sample(name, higher_is_better, variant, index, value(results))
+
+    for index in range(args.bench_rounds):
+        order = VARIANTS if (index % 2 == 0) else tuple(reversed(VARIANTS))
+        for variant in order:
+            print "benchmark round %i: %s..." % (index, variant)
+            for (name, (higher_is_better, value)) in run_bench(variant, elfs[variant]["tests"], args).items():
+                add_sample(name, higher_is_better, variant, index, value)
+
+    return metrics
+
+def _mean(values):
+    return float(sum(values)) / len(values)
+
+'''
+change of the candidate relative to the baseline mean, with its 95% interval.
+returns None if there aren't any pairs to compare.
+'''
+def compare(metric):
+    pairs = [(b, c) for (b, c) in zip(metric["baseline"], metric["candidate"])
+             if (b is not None) and (c is not None)]
+    if (not pairs):
+        return None
+
+    baseline_mean = _mean([b for (b, c) in pairs])
+    candidate_mean = _mean([c for (b, c) in pairs])
+    diffs = [c - b for (b, c) in pairs]
+    mean_diff = _mean(diffs)
+
+    if (len(pairs) > 1):
+        stddev = math.sqrt(sum((d - mean_diff) ** 2 for d in diffs) / (len(diffs) - 1))
+        half_width = t_975(len(diffs) - 1) * stddev / math.sqrt(len(diffs))
+    else:
+        half_width = float("inf")
+
+    scale = abs(baseline_mean) if baseline_mean else 1.0
+    return {"pairs": len(pairs), "baseline": baseline_mean, "candidate": candidate_mean,
+            "diff": mean_diff, "change": mean_diff / scale,
+            "low": (mean_diff - half_width) / scale, "high": (mean_diff + half_width) / scale}
+
+'''
+print the comparison of every metric and return the names of the ones that regressed.
+min_changes: {metric: smallest absolute change that counts as regression}
+'''
+def report(metrics, threshold, min_changes):
+    regressions = []
+
+    print "%-36s %12s %12s %9s %22s  %s" % ("metric", "baseline", "candidate", "change", "95% interval", "")
+    for name in sorted(metrics):
+        metric = metrics[name]
+        result = compare(metric)
+        if (not result):
+            print "%-36s %12s %12s %9s %22s  no samples" % (name, "-", "-", "-", "-")
+            continue
+
+        # how much worse the candidate got, negative if it improved
+        worse = -result["change"] if metric["higher_is_better"] else result["change"]
+        significant = (result["low"] > 0) or (result["high"] < 0)
+        if (result["pairs"] < MIN_PAIRS):
+            verdict = "inconclusive, too few samples"
+        elif (significant and worse > threshold and abs(result["diff"]) < min_changes.get(name, 0)):
+            verdict = "worse, below minimum change"
+        elif (significant and worse > threshold):
+            verdict = "REGRESSION"
+            regressions.append(name)
+        elif (significant and worse < 0):
+            verdict = "better"
+        elif (significant):
+            verdict = "worse, within threshold"
+        else:
+            verdict = "no significant change"
+
+        interval = "[%+.1f%%, %+.1f%%]" % (100 * result["low"], 100 * result["high"])
+        print "%-36s %12.4g %12.4g %+8.1f%% %22s  %s (n=%i)" % (name, result["baseline"], result["candidate"],
+              100 * result["change"], interval, verdict, result["pairs"])
+
+    return regressions
+
+def main():
+    parser = argparse.ArgumentParser(description='compare two builds of the aodvv2 module on the same seeded scenarios')
+    parser.add_argument('-b','--baseline', type=str, help='RIOT directory with the baseline aodvv2 module')
+    parser.add_argument('-c','--candidate', type=str, help='RIOT directory with the candidate aodvv2 module')
+    parser.add_argument('-o','--out', type=str, default="./gate", help='directory for builds, logs and results (default: ./gate)')
+    parser.add_argument('-s','--seeds', type=int, nargs='+', default=range(1, 6), help='scenario seeds (default: 1 2 3 4 5)')
+    parser.add_argument('-t','--time', type=int, default=120, help='duration of each scenario in seconds (default: 120)')
+    parser.add_argument('--topology', type=str, default="grid -g 5x5", help='topology_gen.py model and options (default: "grid -g 5x5")')
+    parser.add_argument('--test-args', type=str, default="", help='further aodv_test.py options, e.g. "-s 2 -lr"')
+    parser.add_argument('--bench-rounds', type=int, default=5, help='runs of the RFC 5444 benchmark per build (default: 5)')
+    parser.add_argument('--bench-tap', type=str, default="tap0", help='existing tap interface the native benchmark binary attaches to (default: tap0)')
+    parser.add_argument('--bench-timeout', type=int, default=600, help='seconds after which a benchmark run is stopped (default: 600)')
+    parser.add_argument('--min-latency-change', type=float, default=RREQ_WAIT_TIME_MS,
+                        help='ms the discovery latency has to grow by to count as regression (default: %i, one RREQ_WAIT_TIME)' % RREQ_WAIT_TIME_MS)
+    parser.add_argument('--threshold', type=float, default=5.0, help='percent a metric may get worse before the gate fails (default: 5)')
+    parser.add_argument('--desvirt', type=str, default="../../riot/desvirt_mehlis", help='desvirt directory')
+    parser.add_argument('--net-name', type=str, default="aodv_gate", help='name of the desvirt net')
+    parser.add_argument('--net-start', type=str,
+                        default="cd {desvirt} && cp {topology} .desvirt/{name}.xml && ./vnet --define --name {name} && ./vnet --start --name {name}",
+                        help='shell command that starts the net of a scenario; {desvirt}, {name} and {topology} are replaced')
+    parser.add_argument('--net-stop', type=str, default="cd {desvirt} && ./vnet --stop --name {name} && ./vnet --undefine --name {name}",
+                        help='shell command that stops the net of a scenario')
+    parser.add_argument('--boot-time', type=int, default=10, help='seconds to wait for the nodes to boot (default: 10)')
+    parser.add_argument('-r','--results', type=str, help='compare the samples of an earlier results.json instead of running anything')
+
+    args = parser.parse_args()
+
+    if (args.results):
+        with open(args.results) as results_file:
+            metrics = json.load(results_file)
+    else:
+        if (not (args.baseline and args.candidate)):
+            parser.error("need a baseline and a candidate, or --results")
+        if (len(args.seeds) < MIN_PAIRS or 0 < args.bench_rounds < MIN_PAIRS):
+            parser.error("need at least %i seeds and benchmark rounds to compare" % MIN_PAIRS)
+        if (not os.path.exists(args.out)):
+            os.makedirs(args.out)
+        metrics = collect(args)
+        with open(os.path.join(args.out, "results.json"), "w") as results_file:
+            json.dump(metrics, results_file, indent=1, sort_keys=True)
+
+    regressions = report(metrics, args.threshold / 100.0, {"discovery latency (ms)": args.min_latency_change})
+    if (regressions):
+        print "\n%i metric(s) regressed by more than %.1f%%: %s" % (len(regressions), args.threshold, ", ".join(regressions))
+        sys.exit(1)
+    print "\nno regressions."
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,273 @@
+'''
+Generate large topologies for the virtual network and for desvirt.
+
+geometric  nodes placed uniformly at random in a square, linked if they are
+           within radio range of each other
+clustered  nodes placed around a few cluster heads (buildings, rooms), linked
+           by radio range as above
+scalefree  Barabasi-Albert preferential attachment: every new node links to m
+           existing nodes, preferring well connected ones
+grid       i x j grid, every node linked to the (up to) 8 nodes around it, like
+           collect_neighbor_coordinates() in aodv_test.py
+line       n nodes in a row
+
+Nodes are numbered 0..n-1. The same seed always gives the same topology.
+Geometric and clustered nodes are numbered from west to east, so that
+blocks of consecutive nodes (which virtualnetwork hands to one thread each)
+share few links.
+Output formats:
+
+edges      sparse adjacency: "# nodes <n>" followed by one "<a> <b>" line per
+           link. virtualnetwork_load_topology() reads this format.
+desvirt    desvirt topology XML. Node i is named <net name>_<i>, so desvirt
+           lists it as "<i>,<port>" in ports.list. aodv_test.py can't tell
+           the neighbors of such a node from its name: write the edge list
+           of the same topology with --edges-output and hand it to
+           aodv_test.py --edges.
+dot        graphviz, see topology_viz.py
+
+The range of the geometric and clustered deployments can be given directly
+or derived from the wanted average degree.
+'''
+import argparse
+import math
+import random
+import sys
+
+def link_by_range(positions, radius):
+    # bucket nodes into radius-sized cells so only neighboring cells are compared
+    cells = {}
+    for (node, (x, y)) in enumerate(positions):
+        cells.setdefault((int(x / radius), int(y / radius)), []).append(node)
+
+    edges = set()
+    for ((cx, cy), nodes) in cells.iteritems():
+        for dx in (-1, 0, 1):
+            for dy in (-1, 0, 1):
+                for a in nodes:
+                    for b in cells.get((cx + dx, cy + dy), []):
+                        if (a < b):
+                            (xa, ya) = positions[a]
+                            (xb, yb) = positions[b]
+                            if ((xa - xb) ** 2 + (ya - yb) ** 2 <= radius ** 2):
+                                edges.add((a, b))
+    return edges
+
+'''
+radio range for which n nodes spread uniformly over a side x side square have
+degree neighbors on average (ignoring the border)
+'''
+def radius_for_degree(n, side, degree):
+    return math.sqrt(degree * side * side / (math.pi * (n - 1)))
+
+def geometric(n, side, radius, rng):
+    positions = sorted((rng.uniform(0, side), rng.uniform(0, side)) for _ in range(n))
+    return (link_by_range(positions, radius), positions)
+
+def clustered(n, side, radius, num_clusters, spread, rng):
+    heads = [(rng.uniform(0, side), rng.uniform(0, side)) for _ in range(num_clusters)]
+    positions = []
+    for _ in range(n):
+        (hx, hy) = rng.choice(heads)
+        x = min(max(rng.gauss(hx, spread), 0), side)
+        y = min(max(rng.gauss(hy, spread), 0), side)
+        positions.append((x, y))
+    positions.sort()
+    return (link_by_range(positions, radius), positions)
+
+def scalefree(n, m, rng):
+    edges = set()
+    # every node appears once per link it has, so picking uniformly from this
+    # list prefers nodes by degree
+    endpoints = []
+
+    for node in range(min(m + 1, n)):
+        for other in range(node):
+            edges.add((other, node))
+            endpoints += [other, node]
+
+    for node in range(m + 1, n):
+        targets = set()
+        while (len(targets) < m):
+            targets.add(rng.choice(endpoints))
+        for other in targets:
+            edges.add((other, node))
+            endpoints += [other, node]
+    return (edges, None)
+
+def grid(i_max, j_max):
+    edges = set()
+    node = lambda i, j: i * j_max + j
+    for i in range(i_max):
+        for j in range(j_max):
+            for (m, k) in ((i, j+1), (i+1, j-1), (i+1, j), (i+1, j+1)):
+                if (0 <= m < i_max and 0 <= k < j_max):
+                    edges.add((node(i, j), node(m, k)))
+    positions = [(float(i), float(j)) for i in range(i_max) for j in range(j_max)]
+    return (edges, positions)
+
+def line(n):
+    return (set((i, i+1) for i in range(n - 1)), [(float(i), 0.0) for i in range(n)])
+
+def adjacency(n, edges):
+    neighbors = [[] for _ in range(n)]
+    for (a, b) in edges:
+        neighbors[a].append(b)
+        neighbors[b].append(a)
+    return neighbors
+
+def components(neighbors):
+    component = [-1] * len(neighbors)
+    sizes = []
+    for start in range(len(neighbors)):
+        if (component[start] >= 0):
+            continue
+        component[start] = len(sizes)
+        frontier = [start]
+        size = 0
+        while (frontier):
+            node = frontier.pop()
+            size += 1
+            for neighbor in neighbors[node]:
+                if (component[neighbor] < 0):
+                    component[neighbor] = len(sizes)
+                    frontier.append(neighbor)
+        sizes.append(size)
+    return (component, sizes)
+
+'''
+keep only the largest connected component, renumbering its nodes from 0
+'''
+def largest_component(n, edges, positions):
+    (component, sizes) = components(adjacency(n, edges))
+    largest = sizes.index(max(sizes))
+    keep = [node for node in range(n) if component[node] == largest]
+    new_id = dict((node, i) for (i, node) in enumerate(keep))
+
+    edges = set((new_id[a], new_id[b]) for (a, b) in edges if component[a] == largest)
+    if (positions):
+        positions = [positions[node] for node in keep]
+    return (len(keep), edges, positions)
+
+'''
+eccentricity of a few random nodes, a cheap lower bound of the diameter
+'''
+def estimate_diameter(neighbors, rng, samples=8):
+    diameter = 0
+    for start in rng.sample(range(len(neighbors)), min(samples, len(neighbors))):
+        distances = {start: 0}
+        frontier = [start]
+        while (frontier):
+            next_frontier = []
+            for node in frontier:
+                for neighbor in neighbors[node]:
+                    if (neighbor not in distances):
+                        distances[neighbor] = distances[node] + 1
+                        next_frontier.append(neighbor)
+            frontier = next_frontier
+        diameter = max(diameter, max(distances.values()))
+    return diameter
+
+def write_edges(out, n, edges):
+    out.write("# nodes %i\n" % n)
+    for (a, b) in sorted(edges):
+        out.write("%i %i\n" % (a, b))
+
+def write_desvirt(out, n, edges, name, binary):
+    out.write('<?xml version="1.0" encoding="UTF-8"?>\n')
+    out.write('<topology version="1">\n')
+    out.write('    <net description="generated by topology_gen.py" name="%s"/>\n' % name)
+    out.write('    <nodeTypes>\n')
+    out.write('        <nodeType name="riot_native">\n')
+    out.write('            <interfaces>\n')
+    out.write('                <interface name="wlan0" type="802.11bg"/>\n')
+    out.write('            </interfaces>\n')
+    out.write('        </nodeType>\n')
+    out.write('    </nodeTypes>\n')
+    out.write('    <nodes>\n')
+    for node in range(n):
+        out.write('        <node binary="%s" name="%s_%i" type="riot_native"/>\n' % (binary, name, node))
+    out.write('    </nodes>\n')
+    out.write('    <links>\n')
+    for (a, b) in sorted(edges):
+        out.write('        <link broadcast_loss="0.0" from_if="wlan0" from_node="%s_%i" loss="0.0" '
+                  'to_if="wlan0" to_node="%s_%i" uni="false"/>\n' % (name, a, name, b))
+    out.write('    </links>\n')
+    out.write('</topology>\n')
+
+def write_dot(out, n, edges, positions):
+    out.write("graph G {\n")
+    for node in range(n):
+        if (positions):
+            out.write("\"%i\" [pos=\"%.2f,%.2f!\"];\n" % (node, positions[node][0], positions[node][1]))
+        else:
+            out.write("\"%i\";\n" % node)
+    for (a, b) in sorted(edges):
+        out.write("\"%i\" -- \"%i\";\n" % (a, b))
+    out.write("}\n")
+
+def main():
+    parser = argparse.ArgumentParser(description='generate topologies for virtualnetwork and desvirt')
+    parser.add_argument('model', choices=['geometric', 'clustered', 'scalefree', 'grid', 'line'])
+    parser.add_argument('-n','--nodes', type=int, default=1000, help='number of nodes (default: 1000)')
+    parser.add_argument('-g','--grid', type=str, default="8x8", help='size of the grid model, IxJ (default: 8x8)')
+    parser.add_argument('--side', type=float, default=1000.0, help='side of the deployment area in meters (default: 1000)')
+    parser.add_argument('-r','--radius', type=float, help='radio range in meters')
+    parser.add_argument('-d','--degree', type=float, default=8.0, help='average degree, used if no radio range is given (default: 8)')
+    parser.add_argument('-c','--clusters', type=int, default=10, help='number of clusters of the clustered model (default: 10)')
+    parser.add_argument('--spread', type=float, default=50.0, help='standard deviation of the distance to the cluster head in meters (default: 50)')
+    parser.add_argument('-m', type=int, default=2, help='links per new node of the scalefree model (default: 2)')
+    parser.add_argument('--connected', action='store_true', help='keep only the largest connected component')
+    parser.add_argument('-f','--format', choices=['edges', 'desvirt', 'dot'], default='edges')
+    parser.add_argument('--name', type=str, default="aodv", help='name of the desvirt net (default: aodv)')
+    parser.add_argument('--binary', type=str, default="../../aodvv2_demo/bin/native/aodvv2_demo.elf", help='RIOT binary desvirt starts on every node')
+    parser.add_argument('-o','--output', type=str, help='output file (default: stdout)')
+    parser.add_argument('--edges-output', type=str, help='also write the topology as edge list to this file (for aodv_test.py --edges)')
+    parser.add_argument('-s','--seed', type=int, default=1, help='random seed')
+
+    args = parser.parse_args()
+    rng = random.Random(args.seed)
+    n = args.nodes
+
+    if (args.model in ('geometric', 'clustered')):
+        radius = args.radius or radius_for_degree(n, args.side, args.degree)
+        if (args.model == 'geometric'):
+            (edges, positions) = geometric(n, args.side, radius, rng)
+        else:
+            (edges, positions) = clustered(n, args.side, radius, args.clusters, args.spread, rng)
+    elif (args.model == 'scalefree'):
+        (edges, positions) = scalefree(n, args.m, rng)
+    elif (args.model == 'grid'):
+        (i_max, j_max) = [int(x) for x in args.grid.split("x")]
+        n = i_max * j_max
+        (edges, positions) = grid(i_max, j_max)
+    else:
+        (edges, positions) = line(n)
+
+    if (args.connected):
+        (n, edges, positions) = largest_component(n, edges, positions)
+
+    neighbors = adjacency(n, edges)
+    (_, sizes) = components(neighbors)
+    degrees = [len(x) for x in neighbors]
+    # statistics go to stderr so they don't end up in the topology
+    sys.stderr.write("%i nodes, %i links, degree avg %.2f max %i, %i component(s), largest %i, diameter >= %i\n"
+                     % (n, len(edges), float(sum(degrees)) / max(n, 1), max(degrees or [0]),
+                        len(sizes), max(sizes or [0]), estimate_diameter(neighbors, rng)))
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    if (args.format == 'edges'):
+        write_edges(out, n, edges)
+    elif (args.format == 'desvirt'):
+        write_desvirt(out, n, edges, args.name, args.binary)
+    else:
+        write_dot(out, n, edges, positions)
+    if (args.output):
+        out.close()
+
+    if (args.edges_output):
+        with open(args.edges_output, 'w') as edges_out:
+            write_edges(edges_out, n, edges)
+
+if __name__ == "__main__":
+    main()
@@ -32,6 +32,49 @@ def prep_graphviz(info):
     gv_str += "}"
     return gv_str
 
+'''
+Follow the routes of a node by feeding it the output of its rt_events command,
+e.g.
+0 add fe80::ff:fe00:60d0 fe80::ff:fe00:60ca 2 3
+1 break fe80::ff:fe00:60d0 fe80::ff:fe00:60ca 2 3
+next 2
+routes maps every node's ip to {destination: next hop}. Returns the id to pass
+to the next rt_events call.
+'''
+def apply_route_events(routes, node_ip, output):
+    node_routes = routes.setdefault(node_ip, {})
+    next_id = None
+
+    for line in output.splitlines():
+        fields = line.split()
+        if (len(fields) == 2 and fields[0] == "next"):
+            next_id = int(fields[1])
+        elif (len(fields) == 2 and fields[0] == "lost"):
+            # events were overwritten before we got to them, fetch print_rt instead
+            print "%s: lost %s route events" % (node_ip, fields[1])
+        elif (len(fields) == 6):
+            (event, dest, next_hop) = fields[1:4]
+            if (event in ("add", "update")):
+                node_routes[dest] = next_hop
+            elif (event in ("break", "expire")):
+                node_routes.pop(dest, None)
+
+    return next_id
+
+'''
+Draw the routes collected by apply_route_events() towards dest: every node
+points to the next hop of its route to dest
+'''
+def prep_route_graphviz(routes, dest):
+    gv_str = "digraph G {"
+
+    for (node_ip, node_routes) in routes.iteritems():
+        if (dest in node_routes):
+            gv_str += "\"%s\" -> \"%s\";\n" %(get_suffix(node_ip), get_suffix(node_routes[dest]))
+
+    gv_str += "}"
+    return gv_str
+
 def get_suffix(ip):
     return ":" + ip.split(":")[-1]
 